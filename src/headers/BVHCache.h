@@ -0,0 +1,39 @@
+#ifndef BVHCACHE_H
+#define BVHCACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TriangleMesh.h"
+#include "Texture.h"
+
+#include "tiny_gltf.h"
+
+// On disk copy of the vertex and index buffers and built BVH of every mesh in a model, so an
+// unchanged asset skips geometry extraction and the BVH build on the next launch.
+// The file is memory mapped when loaded and is only used if its version and content hash match.
+class BVHCache
+{
+public:
+    BVHCache(const std::string& filePath, uint64_t contentHash) : filePath(filePath), contentHash(contentHash) {};
+
+    // Hash of the glTF file and every buffer it loaded, changes whenever the geometry could have
+    static uint64_t hashModel(const std::string& gltfPath, const tinygltf::Model& model);
+
+    // Restores meshCount meshes, returns false and leaves meshes untouched on a miss
+    bool load(size_t meshCount, const std::shared_ptr<std::vector<Texture>>& textures,
+              std::vector<std::shared_ptr<TriangleMesh>>& meshes) const;
+
+    bool save(const std::vector<std::shared_ptr<TriangleMesh>>& meshes) const;
+
+private:
+    // Bump when anything that ends up in the file changes meaning
+    static constexpr uint32_t VERSION = 5;
+
+    std::string filePath;
+    uint64_t contentHash;
+};
+
+#endif // BVHCACHE_H
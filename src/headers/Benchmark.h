@@ -0,0 +1,55 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+
+#include "Camera.h"
+#include "Scene.h"
+#include "RayStream.h"
+#include "bvh/TraversalStats.h"
+
+// Headless acceleration structure benchmark. Rebuilds every mesh of the scene with each
+// BVH configuration, traces one primary ray per pixel and reports speed and memory use. Memory is every
+// tree the meshes keep plus their per-triangle intersection data, traversed only the tree a ray walks,
+// since wide and compressed layouts are kept next to the binary tree instead of replacing it.
+// Tile rows trace the primary rays per TILE_SIZE tile with frustum culling instead of one at a time,
+// packet rows trace each tile as one ray packet, stream rows hand all rays of the frame to a RayStream.
+// Binary layouts are traced a second time through a simple cache and TLB model, since node
+// order mostly shows up as cache misses.
+class Benchmark
+{
+public:
+    struct Result
+    {
+        std::string name;
+        float buildMs;
+        float traceMs;
+        float mraysPerSecond;
+        size_t bvhBytes;         // Every tree kept, see TriangleMesh::getBVHMemory
+        size_t traversedBytes;   // Only the trees intersect walks
+        size_t triangleBytes;    // See TriangleMesh::getTriangleMemory, grows with the leaf blocks
+        float cacheMissesPerRay; // Simulated, binary layouts only, negative when not measured
+        float pageMissesPerRay;
+        TraversalStats stats;    // Summed over all rays, zero unless built with CONSTATINE_TRAVERSAL_STATS
+    };
+
+    Benchmark(int width, int height) : width(width), height(height) {};
+
+    std::vector<Result> run(Scene& scene);
+
+private:
+    enum class TraceMode { PerRay, Tiles, Packets, Streams };
+
+    int width, height;
+
+    Camera frameScene(const Scene& scene) const;
+    Result measure(const std::string& name, Scene& scene, const BVHBuildSettings& settings, const Camera& cam,
+                   TraceMode traceMode) const;
+    void traceTiles(const Scene& scene, const Camera& cam, TraceMode traceMode) const;
+    void traceStream(const Scene& scene, const Camera& cam) const;
+    void simulateCache(const Scene& scene, const Camera& cam, Result& result) const;
+    static void printResult(const Result& result);
+};
+
+#endif // BENCHMARK_H
@@ -5,6 +5,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Ray.h"
+#include "bvh/Frustum.h"
 
 class Camera 
 {
@@ -23,6 +24,9 @@ public:
     // Ray generation
     Ray generateRay(float u, float v) const;
 
+    // Frustum around every ray generateRay returns for u in [u0, u1] and v in [v0, v1]
+    Frustum generateFrustum(float u0, float v0, float u1, float v1) const;
+
     // Matrices
     glm::mat4 getViewMatrix() const;
     glm::mat4 getProjectionMatrix() const;
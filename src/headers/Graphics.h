@@ -5,7 +5,7 @@
 #include <string>
 #include <vector>
 
-struct Scene;
+class Scene;
 
 class Graphics 
 {
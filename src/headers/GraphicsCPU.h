@@ -5,10 +5,15 @@
 
 #include "Graphics.h"
 #include "Camera.h"
+#include "Scene.h"
+#include "RayStream.h"
 #include "TriangleMesh.h"
+#include "bvh/TraversalStats.h"
 #include "primitive/Circle.h"
 #include "light/PointLight.h"
 
+class Plane;
+
 class GraphicsCPU : public Graphics 
 {
 public:
@@ -31,21 +36,76 @@ public:
     // Clean up and shut down the graphics system
     virtual void shutdown() override;
 
-    void addCircle(Circle& circle) { circles.emplace_back(circle); };
-    void addMesh(TriangleMesh& mesh) { meshes.emplace_back(mesh); };
+    // Spheres go into the scene's top level BVH next to the mesh instances
+    void addCircle(const Circle& circle) { scene.addSphere(circle); };
+    // Meshes are shared, adding the same mesh twice only adds another instance of it
+    InstanceId addMesh(const std::shared_ptr<TriangleMesh>& mesh, const glm::mat4& transform = glm::mat4(1.0f)) { return scene.addInstance(mesh, transform); };
+    // Edits are picked up by the next frame, only the top level BVH is refitted or rebuilt
+    void removeMesh(InstanceId id) { scene.removeInstance(id); };
+    void setMeshTransform(InstanceId id, const glm::mat4& transform) { scene.setTransform(id, transform); };
+    void setScene(const Scene& newScene) { scene = newScene; };
+    Scene& getScene() { return scene; };
     void addLight(const PointLight& light) { lights.emplace_back(light); };
 
+    // Heatmap replaces shading with the traversal cost of each primary ray, H toggles it.
+    // Needs a build with CONSTATINE_TRAVERSAL_STATS, the counts are all zero otherwise.
+    enum class RenderMode { Shaded, Heatmap };
+    void setRenderMode(RenderMode mode) { renderMode = mode; };
+
+    // Every frame is traced as streams by default, all primary rays in one RayStream call and then all shadow
+    // rays in another. Tiles traces the primary rays per TILE_SIZE tile with frustum culling instead, PerRay
+    // traverses once per pixel, shadow rays stay streams in both. T cycles through them.
+    enum class TraversalMode { Streams, Tiles, PerRay };
+    void setTraversalMode(TraversalMode mode) { traversalMode = mode; };
+
+    // Traversal work of the last frame, primary and shadow rays together
+    const TraversalStats& getFrameStats() const { return frameStats; };
+
     Camera cam;
 
   private:
     GLFWwindow* window;
-    std::vector<TriangleMesh> meshes;
+    Scene scene;
     std::vector<PointLight> lights;
-    std::vector<Circle> circles;
+    RenderMode renderMode = RenderMode::Shaded;
+    TraversalMode traversalMode = TraversalMode::Streams;
+    TraversalStats frameStats;
+
+    // A shaded surface point waiting for its shadow rays, one per light
+    struct SurfacePoint
+    {
+        int pixel;
+        glm::vec3 point;
+        glm::vec3 normal;
+        glm::vec3 color;
+    };
+
+    // Frame buffers, kept between frames so they are only allocated once
+    RayStream rayStream;
+    std::vector<Ray> primaryRays;
+    std::vector<int> primaryPixels; // y * width + x of every primary ray
+    std::vector<HitRecord> primaryHits;
+    std::vector<float> primaryCost;
+    std::vector<SurfacePoint> surfacePoints;
+    std::vector<Ray> shadowRays;
+    std::vector<uint8_t> shadowBlocked;
+
+    // Generate a ray per pixel in tile order and find the closest hit of each
+    void tracePrimaryRays();
+
+    // Resolve the primary hits against the plane, trace one shadow ray per hit and light as a stream and
+    // draw ambient plus every light that is reached unblocked
+    void shadePrimaryHits(const Plane& plane);
 
     double lastMouseX, lastMouseY;
     bool captureInput = false;
     bool rightMousePressed = false;
+    bool heatmapKeyPressed = false;
+    bool tileKeyPressed = false;
+
+    // Nodes plus primitives a ray has to touch to be drawn red
+    static constexpr float HEATMAP_MAX_COST = 200.0f;
+    static glm::vec3 heatmapColor(float cost);
 };
 
 #endif // GRAPHICS_CPU_H
@@ -0,0 +1,34 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read only memory map of a whole file, the pages are only read from disk when touched
+class MappedFile
+{
+public:
+    MappedFile() {};
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false if the file does not exist or cannot be mapped
+    bool open(const std::string& filePath);
+    void close();
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return fileSize; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t fileSize = 0;
+
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+#endif // MAPPEDFILE_H
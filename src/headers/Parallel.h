@@ -0,0 +1,103 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Number of hardware threads, never 0
+inline unsigned workerCount()
+{
+    unsigned count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
+
+// Split [0, count) into one contiguous chunk per thread and call fn(begin, end, chunkIdx) for each.
+// The calling thread takes the first chunk itself. Returns the number of chunks used.
+template<typename Fn>
+unsigned parallelChunks(size_t count, unsigned threadCount, Fn&& fn)
+{
+    if (threadCount == 0) threadCount = workerCount();
+    threadCount = static_cast<unsigned>(std::min<size_t>(threadCount, std::max<size_t>(count, 1)));
+
+    if (threadCount <= 1) {
+        fn(size_t(0), count, 0u);
+        return 1;
+    }
+
+    size_t chunkSize = (count + threadCount - 1) / threadCount;
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for (unsigned t = 1; t < threadCount; t++) {
+        size_t begin = std::min(count, t * chunkSize);
+        size_t end = std::min(count, begin + chunkSize);
+        threads.emplace_back([&fn, begin, end, t]() { fn(begin, end, t); });
+    }
+    fn(size_t(0), std::min(count, chunkSize), 0u);
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return threadCount;
+}
+
+// Call fn(i) for every i in [0, count), spread over threadCount threads (0 = all)
+template<typename Fn>
+void parallelFor(size_t count, Fn&& fn, unsigned threadCount = 0)
+{
+    parallelChunks(count, threadCount, [&fn](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; i++) {
+            fn(i);
+        }
+    });
+}
+
+// Stable LSD radix sort of keys together with their values, 8 bits per pass.
+// Every pass counts digits per thread, prefix sums them and scatters each slice in parallel.
+template<typename Key>
+void parallelRadixSort(std::vector<Key>& keys, std::vector<uint32_t>& values, unsigned threadCount = 0)
+{
+    const size_t count = keys.size();
+    if (threadCount == 0) threadCount = workerCount();
+
+    std::vector<Key> keysTmp(count);
+    std::vector<uint32_t> valuesTmp(count);
+    std::vector<std::array<size_t, 256>> histograms(threadCount);
+
+    for (unsigned shift = 0; shift < sizeof(Key) * 8; shift += 8) {
+        unsigned chunks = parallelChunks(count, threadCount, [&](size_t begin, size_t end, unsigned t) {
+            std::array<size_t, 256>& histogram = histograms[t];
+            histogram.fill(0);
+            for (size_t i = begin; i < end; i++) {
+                histogram[(keys[i] >> shift) & 0xFF]++;
+            }
+        });
+
+        // Turn the counts into scatter offsets, digit major so every slice stays in order
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            for (unsigned t = 0; t < chunks; t++) {
+                size_t digitCount = histograms[t][digit];
+                histograms[t][digit] = offset;
+                offset += digitCount;
+            }
+        }
+
+        parallelChunks(count, threadCount, [&](size_t begin, size_t end, unsigned t) {
+            std::array<size_t, 256>& offsets = histograms[t];
+            for (size_t i = begin; i < end; i++) {
+                size_t dst = offsets[(keys[i] >> shift) & 0xFF]++;
+                keysTmp[dst] = keys[i];
+                valuesTmp[dst] = values[i];
+            }
+        });
+
+        keys.swap(keysTmp);
+        values.swap(valuesTmp);
+    }
+}
+
+#endif // PARALLEL_H
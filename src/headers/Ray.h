@@ -1,20 +1,59 @@
 #ifndef RAY_H
 #define RAY_H
 
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <glm/vec3.hpp>
 
-class Ray 
+// Compile-time options of the single ray intersection and traversal kernels, combined with |. Each combination
+// is its own template instantiation, so an option costs nothing in the kernels that do not use it.
+enum RayFlags : unsigned
+{
+    RAY_CLOSEST_HIT = 0,         // The closest hit in range with its barycentrics, nothing else
+    RAY_ANY_HIT = 1 << 0,        // Any hit in range will do, the first one ends the traversal (shadow rays)
+    RAY_CULL_BACKFACES = 1 << 1, // Skip triangles whose front (v0, v1, v2 counter-clockwise) faces away from the ray
+    RAY_NO_UVS = 1 << 2,         // Leave the barycentrics out of the hit record, for queries that only need t
+    RAY_ALPHA_TEST = 1 << 3      // Let rays through texels below the alpha cutoff of their MeshPart, meshes add it themselves
+};
+
+// A ray query: only hits in (tmin, tmax) count, and single ray intersection tests lower tmax to every
+// hit they accept, so farther candidates are rejected before any other work. The inverse direction and
+// direction signs the box tests need are computed once here, build a new ray to change the direction.
+class Ray
 {
 public:
+    static constexpr float DEFAULT_TMIN = 1e-8f; // Keeps rays from hitting the surface they start on
+
     Ray(
-        const glm::vec3& origin = glm::vec3(0), 
-        const glm::vec3& direction = glm::vec3(0))
-        : origin(origin), direction(direction) {}
+        const glm::vec3& origin = glm::vec3(0),
+        const glm::vec3& direction = glm::vec3(0),
+        float tmin = DEFAULT_TMIN,
+        float tmax = std::numeric_limits<float>::max())
+        : Ray(origin, direction, safeInverse(direction), tmin, tmax) {}
+
+    // For callers that already have the inverse direction, like ray packets
+    Ray(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& invDirection, float tmin, float tmax)
+        : origin(origin), direction(direction), invDirection(invDirection), tmin(tmin), tmax(tmax),
+          signs((direction.x < 0.0f ? 1u : 0u) | (direction.y < 0.0f ? 2u : 0u) | (direction.z < 0.0f ? 4u : 0u)) {}
 
     glm::vec3 at(float t) const { return origin + t * direction; }
+    bool inRange(float t) const { return t > tmin && t < tmax; }
 
     glm::vec3 origin;
     glm::vec3 direction;
+    glm::vec3 invDirection; // Zero components get a huge but finite inverse, 0 * inf would make slab tests NaN
+    float tmin, tmax;
+    uint32_t signs; // Bit a set when direction[a] is negative, the octant the ray heads into
+
+    static glm::vec3 safeInverse(const glm::vec3& direction)
+    {
+        glm::vec3 safeDir = direction;
+        for (int a = 0; a < 3; a++) {
+            if (std::abs(safeDir[a]) < 1e-20f) safeDir[a] = std::signbit(safeDir[a]) ? -1e-20f : 1e-20f;
+        }
+        return 1.0f / safeDir;
+    }
 };
 
 #endif // RAY_H
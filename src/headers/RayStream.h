@@ -0,0 +1,43 @@
+#ifndef RAYSTREAM_H
+#define RAYSTREAM_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Scene.h"
+
+// Traces large batches of rays, thousands per call, instead of one ray at a time. Rays are binned by
+// the cell of a STREAM_GRID^3 grid over the scene bounds their origin lies in and by the octant of their
+// direction, then every bin is traced in packets of STREAM_PACKET rays (see Scene::intersectPacket),
+// in submission order. Rays of one bin start close together and head the same way, so even incoherent
+// secondary rays give packets that stay together for a while, and consecutive packets walk the same
+// parts of the BVHs. Buffers are kept between calls, so keep one stream around per caller.
+class RayStream
+{
+public:
+    static constexpr int STREAM_GRID = 4;
+    static constexpr int STREAM_PACKET = 64;
+
+    // Closest hits like Scene::intersect, hits[i] belongs to rays[i] and only hits below rays[i].tmax are taken,
+    // the rays themselves are not changed. When cost is given it receives the traversal work of every ray,
+    // averaged over its packet.
+    void intersect(const Scene& scene, const Ray* rays, size_t count, HitRecord* hits, float* cost = nullptr);
+
+    // blocked[i] becomes 1 if anything is hit in (rays[i].tmin, rays[i].tmax) and 0 otherwise, like Scene::occluded
+    void occluded(const Scene& scene, const Ray* rays, size_t count, uint8_t* blocked);
+
+private:
+    static constexpr int BIN_COUNT = STREAM_GRID * STREAM_GRID * STREAM_GRID * 8;
+
+    std::vector<uint16_t> rayBins;  // Bin of every ray of the current call
+    std::vector<uint32_t> order;    // Ray indices grouped by bin, in submission order inside a bin
+    std::vector<uint32_t> binStart; // BIN_COUNT + 1 offsets into order
+
+    void sortIntoBins(const Scene& scene, const Ray* rays, size_t count);
+
+    // Call fn(rayIndices, rayCount) for every run of up to STREAM_PACKET rays of the same bin
+    template<typename Fn>
+    void forEachPacket(Fn&& fn) const;
+};
+
+#endif // RAYSTREAM_H
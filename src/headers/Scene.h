@@ -0,0 +1,132 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <memory>
+#include <optional>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "TriangleMesh.h"
+#include "SphereSet.h"
+#include "bvh/BVH.h"
+#include "primitive/Circle.h"
+#include "primitive/HitResult.h"
+
+#include "tiny_gltf.h"
+
+class Ray;
+class BVHCache;
+
+// Stable handle of a mesh instance, stays valid until the instance is removed
+using InstanceId = uint32_t;
+
+// One placement of a shared mesh in the world
+struct MeshInstance
+{
+    std::shared_ptr<TriangleMesh> mesh; // Bottom level, owns the triangles and their BVH. Null for removed instances.
+    glm::mat4 transform;                // Object to world
+    glm::mat4 invTransform;             // World to object, rays are moved into object space
+    AABB worldBounds;
+};
+
+// What a top level leaf entry refers to, the traversal switches on it instead of calling virtuals
+enum class SceneObjectType : uint32_t
+{
+    MeshInstance, // index into instances
+    Spheres       // the sphere set of the scene, index unused
+};
+
+struct SceneObject
+{
+    SceneObjectType type;
+    uint32_t index;
+};
+
+// Two level acceleration structure: a top level BVH over instances, each instance
+// referencing a mesh with its own bottom level BVH. Repeated meshes are stored once.
+// All spheres share one SphereSet with its own BVH, which is a single object of the top level.
+class Scene
+{
+public:
+    Scene() {};
+
+    // One mesh per glTF mesh and one instance per node that references it.
+    // With a cache the meshes are restored from it when it matches, and written to it when it does not.
+    void loadGLTF(const tinygltf::Model& model, const BVHCache* cache = nullptr);
+
+    // Scene edits only touch the top level BVH: moving or removing an instance refits it, adding one
+    // reuses a removed slot when there is one and otherwise rebuilds it. Bottom level BVHs are left alone.
+    InstanceId addInstance(const std::shared_ptr<TriangleMesh>& mesh, const glm::mat4& transform = glm::mat4(1.0f));
+    void removeInstance(InstanceId id);
+    void setTransform(InstanceId id, const glm::mat4& transform);
+    void addSphere(const Circle& sphere);
+
+    // Call after changing the triangles of a mesh: refits its bottom level BVH and the instances using it
+    void updateMesh(const std::shared_ptr<TriangleMesh>& mesh);
+
+    // Bring the top level BVH up to date with the edits since the last call. Refits when only bounds
+    // changed, rebuilds when objects were added or the refitted tree has degraded too far.
+    void update();
+
+    // Closest hit over all instances and spheres in (ray.tmin, ray.tmax), ray.tmax drops to every hit taken.
+    // Traversal keeps just the compact record (with objectId set), shade turns the final one into a world
+    // space hit, so UVs, textures and normals are only looked at once per ray.
+    // Flags (RayFlags) pick the kernels all the way down, see TriangleMesh::intersect for the ones defined.
+    template<unsigned Flags = RAY_CLOSEST_HIT>
+    bool intersect(Ray& ray, HitRecord& hit) const;
+    HitResult shade(const Ray& ray, const HitRecord& hit) const;
+
+    // Both in one go, the hit is returned in world space and ray is left as it is
+    std::optional<HitResult> intersect(const Ray& ray) const;
+
+    // Closest hits for a tile of coherent rays enclosed by frustum, e.g. the primary rays of a few pixels,
+    // one record per ray with only hits below rays[i].tmax taken. Subtrees outside the frustum are culled for the whole tile, in the top level and
+    // in every instance reached. Shade the records with shade like those of intersect.
+    void intersectTile(const Frustum& frustum, const Ray* rays, uint32_t rayCount, HitRecord* hits) const;
+
+    // Closest hits for the active rays of a packet, the top level and every instance reached are walked by
+    // the whole packet at once (see BVH::intersectPacket). hits[i] belongs to ray i and starts out with
+    // packet.closestT[i] as its t, shade them like those of intersect. Defined for packets of 16 and 64 rays.
+    template<int N>
+    void intersectPacket(RayPacket<N>& packet, PacketMask active, HitRecord* hits) const;
+
+    // True if anything is hit in (ray.tmin, ray.tmax), intersect with RAY_ANY_HIT | RAY_NO_UVS.
+    // Stops at the first hit, shadow rays to a light at ray.at(1) use a tmax of 1.
+    bool occluded(const Ray& ray) const;
+
+    // Rays of the packet that hit anything in (packet.tmin, packet.closestT), the packet version of occluded.
+    // Defined for packets of 16 and 64 rays.
+    template<int N>
+    PacketMask occludedPacket(RayPacket<N>& packet, PacketMask active) const;
+
+    // World bounds of every instance and sphere
+    AABB getBounds() const;
+
+    const std::vector<std::shared_ptr<TriangleMesh>>& getMeshes() const { return meshes; }
+    const std::vector<MeshInstance>& getInstances() const { return instances; } // Includes removed slots
+    size_t getInstanceCount() const { return instances.size() - freeInstances.size(); }
+    const std::vector<Circle>& getSpheres() const { return spheres.getSpheres(); }
+
+private:
+    std::vector<std::shared_ptr<TriangleMesh>> meshes;
+    std::vector<MeshInstance> instances;
+    std::vector<InstanceId> freeInstances; // Removed slots, reused by the next addInstance
+    std::vector<bool> inTopLevel;          // Per slot, whether the current top level BVH has a leaf for it
+    SphereSet spheres;
+    std::vector<SceneObject> objects; // Top level primitives, instances first
+    BVH tlas;
+    bool tlasDirty = false;  // Objects were added, the top level needs a rebuild
+    bool boundsDirty = false; // Only bounds changed, a refit is enough
+    bool spheresDirty = false; // Spheres were added, the sphere set needs a rebuild
+
+    void updateInstanceBounds(MeshInstance& instance);
+    std::vector<AABB> objectBounds() const;
+
+    void loadNode(const tinygltf::Model& model, int nodeIndex, const glm::mat4& parentTransform,
+                  const std::vector<std::shared_ptr<TriangleMesh>>& modelMeshes);
+    static glm::mat4 nodeTransform(const tinygltf::Node& node);
+    static Ray localRay(const MeshInstance& instance, const Ray& ray); // World to object space, same tmin and tmax
+    static AABB transformBounds(const glm::vec3& aabbMin, const glm::vec3& aabbMax, const glm::mat4& transform);
+};
+
+#endif // SCENE_H
@@ -0,0 +1,51 @@
+#ifndef SPHERESET_H
+#define SPHERESET_H
+
+#include <vector>
+#include "./primitive/Circle.h"
+#include "./primitive/SphereBlock.h"
+#include "./primitive/HitResult.h"
+#include "./bvh/BVH.h"
+
+class Ray;
+
+// Many spheres under one BVH, for particle style scenes with thousands of them. The leaves are packed into
+// SphereBlocks of SPHERE_BLOCK_SIZE, so a ray tests a whole leaf in one SIMD step instead of sphere by sphere.
+// The plain records are kept next to the blocks for shading and the packet and tile paths.
+class SphereSet
+{
+public:
+    static constexpr int SPHERE_BLOCK_SIZE = 8;
+
+    // Added spheres are only traced after the next build
+    void add(const Circle& sphere) { spheres.push_back(sphere); }
+    void build();
+
+    bool empty() const { return spheres.empty(); }
+    const std::vector<Circle>& getSpheres() const { return spheres; }
+    AABB getBounds() const; // Empty without spheres or before the first build
+    const BVH& getBVH() const { return bvh; }
+
+    // Closest hit in (ray.tmin, ray.tmax) with the sphere index as primId, ray.tmax drops to every hit taken.
+    // Spheres have no UVs or back faces, so of the RayFlags only RAY_ANY_HIT changes anything.
+    template<unsigned Flags = RAY_CLOSEST_HIT>
+    bool intersect(Ray& ray, HitRecord& hit) const;
+    HitResult shade(const Ray& ray, const HitRecord& hit) const;
+
+    // Same contracts as the TriangleMesh versions
+    void intersectTile(const Frustum& frustum, const Ray* rays, uint32_t rayCount, HitRecord* hits) const;
+    template<int N>
+    void intersectPacket(RayPacket<N>& packet, PacketMask active, HitRecord* hits) const;
+    template<int N>
+    PacketMask occludedPacket(RayPacket<N>& packet, PacketMask active) const;
+
+private:
+    std::vector<Circle> spheres;
+    std::vector<SphereBlock<SPHERE_BLOCK_SIZE>> blocks;
+    std::vector<uint32_t> leafBlocks; // First block of the leaf starting at each primIndices offset
+    BVH bvh;
+
+    static AABB sphereBounds(const Circle& sphere);
+};
+
+#endif // SPHERESET_H
@@ -1,8 +1,10 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <algorithm>
 #include <vector>
 #include <cstdint>
+#include <cmath>
 #include "glm/glm.hpp"
 
 class Texture 
@@ -10,7 +12,16 @@ class Texture
 public:
 
     Texture(int w, int h, int comp, std::vector<unsigned char> imgData)
-        : width(w), height(h), components(comp), data(imgData) {}
+        : width(w), height(h), components(comp), data(imgData)
+    {
+        if (components == 4) {
+            uint8_t lowest = 255;
+            for (size_t i = 3; i < data.size(); i += 4) {
+                lowest = std::min(lowest, data[i]);
+            }
+            minAlpha = lowest / 255.0f;
+        }
+    }
 
     // Sample the texture at normalized UV coordinates (0 to 1)
     glm::vec3 sample(float u, float v) const 
@@ -38,9 +49,26 @@ public:
         // Default to white if texture format is not supported
         return glm::vec3(1.0f);
     }
+
+    // Alpha at normalized UV coordinates, 1 for textures without an alpha channel
+    float sampleAlpha(float u, float v) const
+    {
+        if (components != 4) return 1.0f;
+        u = u - std::floor(u);
+        v = v - std::floor(v);
+        int x = static_cast<int>(u * (width - 1));
+        int y = static_cast<int>(v * (height - 1));
+        return data[(y * width + x) * 4 + 3] / 255.0f;
+    }
+
+    // True if some texel is below alphaCutoff, so a masked material using the texture has holes to alpha test
+    bool hasCutout(float alphaCutoff) const { return minAlpha < alphaCutoff; }
     
     int width, height, components;
     std::vector<uint8_t> data;
+
+private:
+    float minAlpha = 1.0f; // Lowest texel alpha, 1 without an alpha channel
 };
 
 #endif // TEXTURE_H
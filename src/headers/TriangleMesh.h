@@ -1,8 +1,15 @@
 #ifndef TRIANGLEMESH_H
 #define TRIANGLEMESH_H
 
+#include <memory>
+#include <optional>
 #include <vector>
 #include "./primitive/Triangle.h"
+#include "./primitive/TriangleBlock.h"
+#include "./primitive/HitResult.h"
+#include "./bvh/BVH.h"
+#include "./bvh/WideBVH.h"
+#include "./bvh/QuantizedBVH.h"
 #include "./Texture.h"
 #include "glm/fwd.hpp"
 
@@ -10,23 +17,193 @@
 
 class Ray;
 
+// A run of vertices in the shared buffers of a mesh, one per glTF primitive. Primitives never share vertices,
+// so the part of a triangle, and with it its texture, follows from any of its vertex indices.
+struct MeshPart
+{
+    uint32_t firstVertex;
+    int textureIndex; // -1 without a base color texture
+    float alphaCutoff; // glTF alphaMode MASK: rays pass texels with alpha below this. 0 for OPAQUE and BLEND, never cut out
+    bool flatNormals; // The source had no normals, triangles are shaded with their geometric normal
+};
+
+// Triangles are stored indexed: shared vertex positions, normals and UVs plus three 32 bit indices per
+// triangle. Only what the intersection tests precompute (TriangleHot, TriangleAffine, TriangleBlock) is
+// kept per triangle, everything else is read through the indices when a hit is shaded.
 class TriangleMesh 
 {
 public:
-    TriangleMesh() {};
+    TriangleMesh() : textures(std::make_shared<std::vector<Texture>>()) {};
+
+    // Load every mesh in the model into this one mesh, ignoring the node transforms
     void loadGLTF(const tinygltf::Model& model);
+
+    // Load a single glTF mesh, textures are shared with the other meshes of the same model
+    void loadGLTFMesh(const tinygltf::Model& model, const tinygltf::Mesh& mesh,
+                      const std::shared_ptr<std::vector<Texture>>& sharedTextures);
+
+    static std::shared_ptr<std::vector<Texture>> loadTextures(const tinygltf::Model& model);
+
+    // Take over geometry and a BVH built for it earlier instead of loading and building, used by the BVH cache.
+    // positions, normals and uvs all hold vertexCount entries.
+    void loadCached(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* uvs, size_t vertexCount,
+                    const uint32_t* cachedIndices, size_t indexCount, const MeshPart* cachedParts, size_t partCount,
+                    const BVHNode* nodes, size_t nodeCount, const uint32_t* primIndices, size_t primIndexCount,
+                    const BVHBuildSettings& settings, const std::shared_ptr<std::vector<Texture>>& sharedTextures);
+
+    // Append a triangle with vertices of its own, for geometry that does not come from glTF. Call buildBVH after.
+    // A non-zero alphaCutoff masks it like a glTF MASK material, see MeshPart.
+    void addTriangle(const Triangle& triangle, float alphaCutoff = 0.0f);
+
+    // (Re)build the acceleration structure, call after changing the triangles.
+    // With settings.clusterNodes the triangles are also reordered to match the leaves.
+    void buildBVH(const BVHBuildSettings& settings = BVHBuildSettings());
+
+    // Cheap update for deforming meshes, call after moving the vertices through getPositions.
+    // Falls back to a full rebuild with the last settings once the refitted tree has degraded too far.
+    // SBVH meshes are always rebuilt, their split references cannot be refitted from whole triangles.
+    void refitBVH();
+
+    // Per-triangle intersection test, Moller-Trumbore by default. BaldwinWeber keeps a precomputed
+    // transform per triangle next to the hot copy, blocked leaves (leafGroupSize 4 or 8) always use Moller-Trumbore.
+    void setTriangleTest(TriangleTest test);
+    TriangleTest getTriangleTest() const { return triangleTest; }
+
+    // Closest hit against all triangles in (ray.tmin, ray.tmax), ray.tmax drops to every hit taken. Traversal only
+    // fills the compact record, shade turns the final one into a full hit once the caller knows it is the closest.
+    // With a leafGroupSize of 4 or 8 the leaves are tested a block of triangles at a time.
+    // Flags (RayFlags) pick the kernel, meshes with cut out textures add RAY_ALPHA_TEST themselves.
+    // Defined for RAY_CLOSEST_HIT, RAY_CULL_BACKFACES, RAY_NO_UVS and RAY_ANY_HIT | RAY_NO_UVS.
+    template<unsigned Flags = RAY_CLOSEST_HIT>
+    bool intersect(Ray& ray, HitRecord& hit) const;
+    HitResult shade(const Ray& ray, const HitRecord& hit) const;
+
+    // Both in one go, leaves ray as it is
+    std::optional<HitResult> intersect(const Ray& ray) const;
+
+    // Closest hits for a tile of coherent rays enclosed by frustum (see BVH::intersectTile), one record per ray,
+    // only hits below rays[i].tmax are taken. Always walks the binary BVH, which is kept next to the wide layouts.
+    // Like intersect this and the packet tests below let rays through cut out texels.
+    void intersectTile(const Frustum& frustum, const Ray* rays, uint32_t rayCount, HitRecord* hits) const;
+
+    // Closest hits for the active rays of a packet (see BVH::intersectPacket), hits[i] belongs to ray i and
+    // starts out with packet.closestT[i] as its t. Walks the binary BVH with the Moller-Trumbore test.
+    // Defined for packets of 16 and 64 rays.
+    template<int N>
+    void intersectPacket(RayPacket<N>& packet, PacketMask active, HitRecord* hits) const;
+
+    // True if any triangle is hit in (ray.tmin, ray.tmax), for shadow rays. intersect with RAY_ANY_HIT | RAY_NO_UVS.
+    bool occluded(const Ray& ray) const;
+
+    // Rays of the packet that hit any triangle in (packet.tmin, packet.closestT), see BVH::occludedPacket
+    template<int N>
+    PacketMask occludedPacket(RayPacket<N>& packet, PacketMask active) const;
     
-    std::vector<Triangle>& getTriangles() { return triangles; }
-    std::vector<Texture>& getTextures() { return textures; }
+    // Full record of one triangle, assembled from the shared buffers
+    Triangle getTriangle(uint32_t triIdx) const;
+    uint32_t getTriangleCount() const { return static_cast<uint32_t>(indices.size() / 3); }
+
+    // Edit vertices through getPositions and call refitBVH or buildBVH, which also update the per-triangle data
+    std::vector<glm::vec3>& getPositions() { return positions; }
+    const std::vector<glm::vec3>& getPositions() const { return positions; }
+    const std::vector<glm::vec3>& getNormals() const { return normals; }
+    const std::vector<glm::vec2>& getUVs() const { return uvs; }
+    const std::vector<uint32_t>& getIndices() const { return indices; }
+    const std::vector<MeshPart>& getParts() const { return parts; }
+    const std::vector<TriangleHot>& getHotTriangles() const { return hotTriangles; }
+    const std::vector<TriangleAffine>& getAffineTriangles() const { return affineTriangles; }
+    std::vector<Texture>& getTextures() { return *textures; }
+    const BVH& getBVH() const { return bvh; }
+    const BVHBuildSettings& getBVHSettings() const { return bvhSettings; }
+    // Bytes of every tree the mesh keeps: the float binary BVH, which refit, the cache, tiles, packets and streams
+    // always use, plus the wide or compressed copy the settings add. getTraversedBVHMemory is only the copy
+    // intersect walks, the per-ray working set.
+    size_t getBVHMemory() const;
+    size_t getTraversedBVHMemory() const;
+    // Bytes of the per-triangle intersection data: the hot and affine copies and, for 4 or 8 triangle leaves,
+    // the SIMD blocks, which hold every triangle once more in padded lanes
+    size_t getTriangleMemory() const;
 
 private:
-    std::vector<Triangle> triangles;
-    std::vector<Texture> textures;
+    std::vector<glm::vec3> positions;      // Shared vertex attributes, all the same length
+    std::vector<glm::vec3> normals;        // Triangles are shaded with the normal of their first vertex
+    std::vector<glm::vec2> uvs;
+    std::vector<uint32_t> indices;         // Three per triangle, triangle i is indices[3i, 3i + 3)
+    std::vector<MeshPart> parts;           // Sorted by firstVertex
+    std::vector<TriangleHot> hotTriangles; // What the intersection tests read, one per triangle
+    std::vector<TriangleAffine> affineTriangles; // Replaces hotTriangles in the tests for TriangleTest::BaldwinWeber
+    TriangleTest triangleTest = TriangleTest::MollerTrumbore;
+    bool alphaTested = false;              // Some masked part uses a texture with texels below its cutoff
+    std::vector<TriangleBlock<4>> blocks4; // Leaves packed for the SIMD test, only filled for a leafGroupSize of 4 or 8
+    std::vector<TriangleBlock<8>> blocks8;
+    std::vector<uint32_t> leafBlocks;      // First block of the leaf starting at each primIndices offset
+    std::shared_ptr<std::vector<Texture>> textures;
+    BVH bvh;
+    BVH4 bvh4; // Only filled when the settings ask for a wide or compressed layout
+    BVH8 bvh8;
+    QuantizedBVH2 qbvh2;
+    QuantizedBVH4 qbvh4;
+    QuantizedBVH8 qbvh8;
+    BVHBuildSettings bvhSettings;
+
+    void clearGeometry();
+    void buildWideBVH();
+    void updateHotTriangles();
+    void buildTriangleBlocks();
+
+    template<int N>
+    void packLeaves(std::vector<TriangleBlock<N>>& blocks);
+    // Per lane stand-in for intersectPacketTriangle on alpha tested meshes, same contract
+    template<int N>
+    PacketMask intersectPacketAlphaTested(RayPacket<N>& packet, PacketMask active, uint32_t triIdx,
+                                          float* t, float* u, float* v) const;
+    template<unsigned Flags, int N>
+    bool intersectBlocks(Ray& ray, HitRecord& hit, const std::vector<TriangleBlock<N>>& blocks) const;
+
+    // Call fn with the structure the settings select, they all share the same intersect signature
+    template<typename Fn>
+    void visitBVH(Fn&& fn) const;
+
+    // Call fn with the triangle array triangleTest selects, both share TriangleHot's intersect signature
+    template<typename Fn>
+    void visitTriangles(Fn&& fn) const;
+
+    std::vector<AABB> computeTriangleBounds() const;
+    const MeshPart& partOf(uint32_t vertexIdx) const;
+    bool opaqueAt(uint32_t triIdx, float u, float v) const; // False where the texture is cut out, see Texture::sampleAlpha
 
-    void loadTextures(const tinygltf::Model& model);
     void processPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive);
 
     glm::vec3 computeNormal(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) const;
 };
 
+template<typename Fn>
+void TriangleMesh::visitBVH(Fn&& fn) const
+{
+    if (bvhSettings.compressed) {
+        switch (bvhSettings.layout) {
+        case BVHLayout::Wide4: fn(qbvh4); break;
+        case BVHLayout::Wide8: fn(qbvh8); break;
+        default: fn(qbvh2); break;
+        }
+        return;
+    }
+
+    switch (bvhSettings.layout) {
+    case BVHLayout::Wide4: fn(bvh4); break;
+    case BVHLayout::Wide8: fn(bvh8); break;
+    default: fn(bvh); break;
+    }
+}
+
+template<typename Fn>
+void TriangleMesh::visitTriangles(Fn&& fn) const
+{
+    if (triangleTest == TriangleTest::BaldwinWeber) {
+        fn(affineTriangles);
+    } else {
+        fn(hotTriangles);
+    }
+}
+
 #endif // TRIANGLEMESH_H
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <glm/glm.hpp>
+#include <limits>
+
+// Axis aligned bounding box, starts out empty (inverted) so the first grow() sets it
+struct AABB
+{
+    glm::vec3 bmin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 bmax = glm::vec3(-std::numeric_limits<float>::max());
+
+    void grow(const glm::vec3& p)
+    {
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+
+    void grow(const AABB& b)
+    {
+        bmin = glm::min(bmin, b.bmin);
+        bmax = glm::max(bmax, b.bmax);
+    }
+
+    bool empty() const { return bmin.x > bmax.x; }
+
+    glm::vec3 centroid() const { return (bmin + bmax) * 0.5f; }
+
+    // Half of the surface area, the factor 2 cancels out in every SAH comparison
+    float area() const
+    {
+        if (empty()) return 0.0f;
+        glm::vec3 e = bmax - bmin;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+#endif // AABB_H
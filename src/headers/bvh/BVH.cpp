@@ -0,0 +1,393 @@
+#include "BVH.h"
+#include "BVHBuilder.h"
+#include "../Parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <future>
+#include <numeric>
+#include <queue>
+
+void BVH::build(const std::vector<AABB>& primBounds, const BVHBuildSettings& settings, const PrimClipFn& clipPrim)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    nodes.clear();
+    primIndices.clear();
+
+    const uint32_t primCount = static_cast<uint32_t>(primBounds.size());
+    if (primCount == 0) return;
+
+    BuildContext ctx{primBounds, {}, settings.threadCount == 0 ? workerCount() : settings.threadCount};
+    ctx.leafGroupSize = std::max(settings.leafGroupSize, 1u);
+    ctx.centroids.resize(primCount);
+    parallelFor(primCount, [&](size_t i) { ctx.centroids[i] = primBounds[i].centroid(); }, ctx.threadCount);
+
+    primIndices.resize(primCount);
+    std::iota(primIndices.begin(), primIndices.end(), 0);
+
+    // Spatial splits may reference a primitive from more than one leaf
+    const bool spatialSplits = settings.mode == BVHBuildMode::SBVH && clipPrim;
+    const uint32_t maxRefs = spatialSplits ? primCount + static_cast<uint32_t>(primCount * std::max(settings.splitBudget, 0.0f)) : primCount;
+
+    // A binary tree with N leaves never needs more than 2N - 1 nodes, allocating them
+    // up front lets threads grab node pairs without ever reallocating
+    nodes.resize(2 * maxRefs - 1);
+
+    BVHNode& root = nodes[ctx.nodesUsed++];
+    root.leftFirst = 0;
+    root.primCount = primCount;
+
+    if (spatialSplits) {
+        ctx.clipPrim = &clipPrim;
+        ctx.splitBudget = maxRefs - primCount;
+        primIndices.resize(maxRefs);
+        buildSBVH(ctx);
+        primIndices.resize(ctx.primsUsed);
+        primIndices.shrink_to_fit();
+    } else if (settings.mode == BVHBuildMode::LBVH) {
+        buildLBVH(ctx);
+    } else {
+        updateNodeBounds(root, ctx);
+        subdivide(0, ctx, 0);
+    }
+
+    nodes.resize(ctx.nodesUsed);
+    nodes.shrink_to_fit();
+
+    if (settings.clusterNodes) clusterNodes();
+
+    buildCost = computeSAHCost();
+    currentCost = buildCost;
+
+    buildTimeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+void BVH::assign(const BVHNode* srcNodes, size_t nodeCount, const uint32_t* srcPrimIndices, size_t primIndexCount)
+{
+    nodes.assign(srcNodes, srcNodes + nodeCount);
+    primIndices.assign(srcPrimIndices, srcPrimIndices + primIndexCount);
+
+    buildCost = computeSAHCost();
+    currentCost = buildCost;
+    buildTimeMs = 0.0f;
+}
+
+void BVH::clusterNodes()
+{
+    if (nodes.size() <= 1) return;
+
+    auto nodeArea = [](const BVHNode& node) { return AABB{node.aabbMin, node.aabbMax}.area(); };
+
+    // Until its children are placed, a node copied into clustered keeps the old index of its left child
+    std::vector<BVHNode> clustered;
+    clustered.reserve(nodes.size());
+    clustered.push_back(nodes[0]);
+
+    std::vector<uint32_t> treeletRoots;
+    if (!nodes[0].isLeaf()) treeletRoots.push_back(0);
+
+    using Candidate = std::pair<float, uint32_t>; // Area and new index of a node whose children are not placed yet
+    std::priority_queue<Candidate> candidates;
+    std::vector<Candidate> leftOver;
+
+    while (!treeletRoots.empty()) {
+        uint32_t rootIdx = treeletRoots.back();
+        treeletRoots.pop_back();
+        candidates.push({nodeArea(clustered[rootIdx]), rootIdx});
+
+        for (uint32_t treeletSize = 0; !candidates.empty() && treeletSize + 2 <= TREELET_NODES; treeletSize += 2) {
+            uint32_t parentIdx = candidates.top().second;
+            candidates.pop();
+
+            uint32_t oldLeft = clustered[parentIdx].leftFirst;
+            uint32_t newLeft = static_cast<uint32_t>(clustered.size());
+            clustered[parentIdx].leftFirst = newLeft;
+            for (uint32_t c = 0; c < 2; c++) {
+                const BVHNode& child = nodes[oldLeft + c];
+                clustered.push_back(child);
+                if (!child.isLeaf()) candidates.push({nodeArea(child), newLeft + c});
+            }
+        }
+
+        // Children the treelet had no room for root the next treelets, largest area on top of the stack
+        leftOver.clear();
+        while (!candidates.empty()) {
+            leftOver.push_back(candidates.top());
+            candidates.pop();
+        }
+        for (auto it = leftOver.rbegin(); it != leftOver.rend(); ++it) {
+            treeletRoots.push_back(it->second);
+        }
+    }
+
+    nodes.swap(clustered);
+}
+
+std::vector<uint32_t> BVH::sortPrimitives()
+{
+    // Spatial splits can reference a primitive twice, it keeps the position of its first reference
+    uint32_t primCount = 0;
+    for (uint32_t primIdx : primIndices) {
+        primCount = std::max(primCount, primIdx + 1);
+    }
+
+    std::vector<uint32_t> newIndex(primCount, UINT32_MAX);
+    std::vector<uint32_t> oldIndex;
+    oldIndex.reserve(primCount);
+
+    std::vector<uint32_t> stack{0};
+    while (!stack.empty() && !nodes.empty()) {
+        const BVHNode& node = nodes[stack.back()];
+        stack.pop_back();
+        if (!node.isLeaf()) {
+            stack.push_back(node.leftFirst + 1);
+            stack.push_back(node.leftFirst);
+            continue;
+        }
+        for (uint32_t i = 0; i < node.primCount; i++) {
+            uint32_t primIdx = primIndices[node.leftFirst + i];
+            if (newIndex[primIdx] == UINT32_MAX) {
+                newIndex[primIdx] = static_cast<uint32_t>(oldIndex.size());
+                oldIndex.push_back(primIdx);
+            }
+        }
+    }
+
+    // Primitives no leaf references still need a place so the owner keeps all of them
+    for (uint32_t primIdx = 0; primIdx < primCount; primIdx++) {
+        if (newIndex[primIdx] == UINT32_MAX) oldIndex.push_back(primIdx);
+    }
+
+    for (uint32_t& primIdx : primIndices) {
+        primIdx = newIndex[primIdx];
+    }
+    return oldIndex;
+}
+
+void BVH::refit(const std::vector<AABB>& primBounds, unsigned threadCount)
+{
+    if (nodes.empty()) return;
+    if (threadCount == 0) threadCount = workerCount();
+
+    // Walk down breadth first until there are enough independent subtrees to keep every thread busy
+    std::vector<uint32_t> subtrees{0};
+    std::vector<uint32_t> topNodes;
+    while (subtrees.size() < threadCount * 4) {
+        std::vector<uint32_t> next;
+        for (uint32_t nodeIdx : subtrees) {
+            const BVHNode& node = nodes[nodeIdx];
+            if (node.isLeaf()) {
+                next.push_back(nodeIdx);
+            } else {
+                topNodes.push_back(nodeIdx);
+                next.push_back(node.leftFirst);
+                next.push_back(node.leftFirst + 1);
+            }
+        }
+        if (next.size() == subtrees.size()) break; // Only leaves left
+        subtrees.swap(next);
+    }
+
+    parallelFor(subtrees.size(), [&](size_t i) { refitNode(subtrees[i], primBounds); }, threadCount);
+
+    // Parents were collected before their children, so walking backwards is bottom up
+    for (auto it = topNodes.rbegin(); it != topNodes.rend(); ++it) {
+        BVHNode& node = nodes[*it];
+        const BVHNode& left = nodes[node.leftFirst];
+        const BVHNode& right = nodes[node.leftFirst + 1];
+        node.aabbMin = glm::min(left.aabbMin, right.aabbMin);
+        node.aabbMax = glm::max(left.aabbMax, right.aabbMax);
+    }
+
+    currentCost = computeSAHCost();
+}
+
+void BVH::refitNode(uint32_t nodeIdx, const std::vector<AABB>& primBounds)
+{
+    BVHNode& node = nodes[nodeIdx];
+    AABB bounds;
+
+    if (node.isLeaf()) {
+        for (uint32_t i = 0; i < node.primCount; i++) {
+            bounds.grow(primBounds[primIndices[node.leftFirst + i]]);
+        }
+    } else {
+        refitNode(node.leftFirst, primBounds);
+        refitNode(node.leftFirst + 1, primBounds);
+        const BVHNode& left = nodes[node.leftFirst];
+        const BVHNode& right = nodes[node.leftFirst + 1];
+        bounds.bmin = glm::min(left.aabbMin, right.aabbMin);
+        bounds.bmax = glm::max(left.aabbMax, right.aabbMax);
+    }
+
+    node.aabbMin = bounds.bmin;
+    node.aabbMax = bounds.bmax;
+}
+
+float BVH::computeSAHCost() const
+{
+    if (nodes.empty()) return 0.0f;
+
+    // Expected cost of a random ray that hits the root: every node is weighted by the
+    // chance of being entered, with box and primitive tests assumed equally expensive
+    float cost = 0.0f;
+    for (const BVHNode& node : nodes) {
+        AABB bounds{node.aabbMin, node.aabbMax};
+        cost += bounds.area() * (node.isLeaf() ? static_cast<float>(node.primCount) : 1.0f);
+    }
+
+    AABB rootBounds{nodes[0].aabbMin, nodes[0].aabbMax};
+    float rootArea = rootBounds.area();
+    return rootArea > 0.0f ? cost / rootArea : 0.0f;
+}
+
+void BVH::updateNodeBounds(BVHNode& node, const BuildContext& ctx) const
+{
+    AABB bounds;
+    for (uint32_t i = 0; i < node.primCount; i++) {
+        bounds.grow(ctx.bounds[primIndices[node.leftFirst + i]]);
+    }
+    node.aabbMin = bounds.bmin;
+    node.aabbMax = bounds.bmax;
+}
+
+float BVH::findBestSplitPlane(const BVHNode& node, const BuildContext& ctx, const AABB& centroidBounds,
+                              int& axis, int& splitBin) const
+{
+    // Bin over the centroid bounds, not the node bounds, so no bins are wasted
+    glm::vec3 extent = centroidBounds.bmax - centroidBounds.bmin;
+    glm::vec3 scale;
+    for (int a = 0; a < 3; a++) {
+        scale[a] = extent[a] > 0.0f ? BINS / extent[a] : 0.0f;
+    }
+
+    using BinGrid = std::array<std::array<Bin, BINS>, 3>;
+    auto binRange = [&](size_t begin, size_t end, BinGrid& bins) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t primIdx = primIndices[node.leftFirst + i];
+            const glm::vec3& c = ctx.centroids[primIdx];
+            for (int a = 0; a < 3; a++) {
+                int binIdx = std::min(BINS - 1, static_cast<int>((c[a] - centroidBounds.bmin[a]) * scale[a]));
+                bins[a][binIdx].count++;
+                bins[a][binIdx].bounds.grow(ctx.bounds[primIdx]);
+            }
+        }
+    };
+
+    BinGrid bins;
+    if (node.primCount >= PARALLEL_BINNING_THRESHOLD && ctx.threadCount > 1) {
+        // Every thread bins its own slice, the partial bins are merged afterwards
+        std::vector<BinGrid> threadBins(ctx.threadCount);
+        unsigned chunks = parallelChunks(node.primCount, ctx.threadCount, [&](size_t begin, size_t end, unsigned t) {
+            binRange(begin, end, threadBins[t]);
+        });
+        for (unsigned t = 0; t < chunks; t++) {
+            for (int a = 0; a < 3; a++) {
+                for (int b = 0; b < BINS; b++) {
+                    bins[a][b].count += threadBins[t][a][b].count;
+                    bins[a][b].bounds.grow(threadBins[t][a][b].bounds);
+                }
+            }
+        }
+    } else {
+        binRange(0, node.primCount, bins);
+    }
+
+    float bestCost = std::numeric_limits<float>::max();
+    for (int a = 0; a < 3; a++) {
+        if (scale[a] == 0.0f) continue;
+
+        // Sweep from both sides to get the area and count left and right of every plane
+        float leftArea[BINS - 1], rightArea[BINS - 1];
+        uint32_t leftCount[BINS - 1], rightCount[BINS - 1];
+        AABB leftBox, rightBox;
+        uint32_t leftSum = 0, rightSum = 0;
+        for (int i = 0; i < BINS - 1; i++) {
+            leftSum += bins[a][i].count;
+            leftCount[i] = leftSum;
+            leftBox.grow(bins[a][i].bounds);
+            leftArea[i] = leftBox.area();
+
+            rightSum += bins[a][BINS - 1 - i].count;
+            rightCount[BINS - 2 - i] = rightSum;
+            rightBox.grow(bins[a][BINS - 1 - i].bounds);
+            rightArea[BINS - 2 - i] = rightBox.area();
+        }
+
+        for (int i = 0; i < BINS - 1; i++) {
+            if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+            float cost = ctx.primCost(leftCount[i]) * leftArea[i] + ctx.primCost(rightCount[i]) * rightArea[i];
+            if (cost < bestCost) {
+                axis = a;
+                splitBin = i;
+                bestCost = cost;
+            }
+        }
+    }
+
+    return bestCost;
+}
+
+void BVH::subdivide(uint32_t nodeIdx, BuildContext& ctx, int depth)
+{
+    BVHNode& node = nodes[nodeIdx];
+    if (node.primCount <= 1 || depth >= MAX_DEPTH) return;
+
+    AABB centroidBounds;
+    for (uint32_t i = 0; i < node.primCount; i++) {
+        centroidBounds.grow(ctx.centroids[primIndices[node.leftFirst + i]]);
+    }
+
+    int axis = -1;
+    int splitBin = 0;
+    float splitCost = findBestSplitPlane(node, ctx, centroidBounds, axis, splitBin);
+
+    // Only split when it is cheaper than intersecting everything in this node
+    AABB nodeBounds{node.aabbMin, node.aabbMax};
+    float noSplitCost = ctx.primCost(node.primCount) * nodeBounds.area();
+    if (axis < 0 || splitCost >= noSplitCost) return;
+
+    // Partition the primitive indices in place on bin index
+    float boundsMin = centroidBounds.bmin[axis];
+    float scale = BINS / (centroidBounds.bmax[axis] - boundsMin);
+    uint32_t* first = primIndices.data() + node.leftFirst;
+    uint32_t* last = first + node.primCount;
+    uint32_t* mid = std::partition(first, last, [&](uint32_t primIdx) {
+        int binIdx = std::min(BINS - 1, static_cast<int>((ctx.centroids[primIdx][axis] - boundsMin) * scale));
+        return binIdx <= splitBin;
+    });
+
+    uint32_t leftCount = static_cast<uint32_t>(mid - first);
+    if (leftCount == 0 || leftCount == node.primCount) return;
+
+    uint32_t leftChildIdx = ctx.nodesUsed.fetch_add(2);
+    uint32_t rightChildIdx = leftChildIdx + 1;
+
+    nodes[leftChildIdx].leftFirst = node.leftFirst;
+    nodes[leftChildIdx].primCount = leftCount;
+    nodes[rightChildIdx].leftFirst = node.leftFirst + leftCount;
+    nodes[rightChildIdx].primCount = node.primCount - leftCount;
+
+    node.leftFirst = leftChildIdx;
+    node.primCount = 0;
+
+    updateNodeBounds(nodes[leftChildIdx], ctx);
+    updateNodeBounds(nodes[rightChildIdx], ctx);
+
+    // Children own disjoint node and primitive ranges, so big subtrees can be built concurrently
+    bool spawnTask = nodes[leftChildIdx].primCount >= PARALLEL_TASK_THRESHOLD &&
+                     nodes[rightChildIdx].primCount >= PARALLEL_TASK_THRESHOLD;
+    if (spawnTask && ctx.tryStartTask()) {
+        auto leftTask = std::async(std::launch::async, [&]() {
+            subdivide(leftChildIdx, ctx, depth + 1);
+            ctx.finishTask();
+        });
+        subdivide(rightChildIdx, ctx, depth + 1);
+        leftTask.wait();
+    } else {
+        subdivide(leftChildIdx, ctx, depth + 1);
+        subdivide(rightChildIdx, ctx, depth + 1);
+    }
+}
@@ -0,0 +1,489 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "Frustum.h"
+#include "RayPacket.h"
+#include "TraversalStats.h"
+#include "../Ray.h"
+
+// 32 byte node, two of them fill a 64 byte cache line
+struct BVHNode
+{
+    glm::vec3 aabbMin;
+    uint32_t leftFirst; // Index of the left child (right = left + 1) or of the first primitive in a leaf
+    glm::vec3 aabbMax;
+    uint32_t primCount; // 0 for interior nodes
+
+    bool isLeaf() const { return primCount > 0; }
+};
+
+enum class BVHBuildMode
+{
+    SAH,  // Binned surface area heuristic, best traversal speed
+    LBVH, // Morton code ordered, much faster to build but slower to traverse
+    SBVH  // SAH with spatial splits, slowest build but the best trees for large overlapping primitives
+};
+
+// Node layout traversed after the build, the wide layouts are collapsed from the binary tree
+enum class BVHLayout
+{
+    Binary,
+    Wide4, // SSE box tests
+    Wide8  // AVX box tests, falls back to scalar without AVX
+};
+
+struct BVHBuildSettings
+{
+    BVHBuildMode mode = BVHBuildMode::SAH;
+    BVHLayout layout = BVHLayout::Binary;
+    bool compressed = false;  // Traverse a QuantizedBVH with child bounds as 8 bit offsets inside their parent. It is built
+                              // next to the float binary tree, so it shrinks what a ray reads, not the memory kept
+    unsigned threadCount = 0; // 0 uses every hardware thread, 1 builds single threaded
+    float splitBudget = 0.3f; // SBVH only: extra references spatial splits may add, relative to the primitive count
+    bool clusterNodes = false; // Lay the nodes out in page sized treelets after the build (see BVH::clusterNodes)
+    uint32_t leafGroupSize = 1; // Primitives a leaf test handles at once, the SAH counts leaves in whole groups.
+                                // TriangleMesh stores leaves as SIMD triangle blocks for 4 and 8 (see TriangleBlock.h)
+};
+
+// Bounds of the part of primitive primIdx that lies inside box, empty if nothing does.
+// The SBVH builder uses it to divide primitives between leaves.
+using PrimClipFn = std::function<AABB(uint32_t primIdx, const AABB& box)>;
+
+// Bounding volume hierarchy over an arbitrary set of primitives.
+// The builder only needs a bounding box per primitive, the actual primitive test
+// is supplied by the owner during traversal so the same tree works for any type.
+class BVH
+{
+public:
+    BVH() {};
+
+    // Build over the given primitive bounds with the builder selected in the settings.
+    // SAH: large nodes are binned in parallel and subtrees are handed out as tasks.
+    // LBVH: centroids are radix sorted on Morton code and the tree is emitted from the sorted order.
+    // SBVH: needs clipPrim, without it the SAH builder is used instead.
+    void build(const std::vector<AABB>& primBounds, const BVHBuildSettings& settings = BVHBuildSettings(),
+               const PrimClipFn& clipPrim = nullptr);
+
+    // Take over a tree built earlier, e.g. one restored from the BVH cache
+    void assign(const BVHNode* srcNodes, size_t nodeCount, const uint32_t* srcPrimIndices, size_t primIndexCount);
+
+    // Update the node bounds bottom up after the primitives moved, the topology stays the same.
+    // primBounds are whole primitives, so rebuild SBVH trees instead, their leaves hold clipped references.
+    // The lower subtrees are refitted in parallel, the few nodes above them on the calling thread.
+    void refit(const std::vector<AABB>& primBounds, unsigned threadCount = 0);
+
+    // SAH cost of the tree relative to its root area, lower is better
+    float computeSAHCost() const;
+
+    // Current cost divided by the cost straight after the last build, 1 for a fresh tree.
+    // Refitting keeps the topology, so once primitives drift apart this keeps growing.
+    float getDegradation() const { return buildCost > 0.0f ? currentCost / buildCost : 1.0f; }
+    bool needsRebuild() const { return getDegradation() > REBUILD_THRESHOLD; }
+
+    // Reorder the nodes from depth first into treelets of up to TREELET_NODES nodes. Each treelet grows
+    // from its root by adding the child pair with the largest parent area, the pair most rays reach,
+    // so nodes usually visited together share cache lines and pages. Subtrees left over start their
+    // own treelets, placed depth first after it. Only the node order changes, not the tree.
+    void clusterNodes();
+
+    // Renumber the primitives in the order the leaves reference them, so a traversal walks the
+    // primitive array forwards. Returns the old index of every new primitive index, the owner
+    // has to reorder its primitives with it.
+    std::vector<uint32_t> sortPrimitives();
+
+    // Single ray traversal, calls testPrim(primIdx) for every primitive in every leaf the ray reaches.
+    // Closest hit by default: the nearer child goes first and testPrim is expected to lower closestT on a hit.
+    // With RAY_ANY_HIT in Flags testPrim returns whether the primitive was hit, the first hit ends the
+    // traversal and is returned. The other flags only matter to the primitive test.
+    template<unsigned Flags = RAY_CLOSEST_HIT, typename PrimFn>
+    bool intersect(const Ray& ray, float& closestT, PrimFn&& testPrim) const;
+
+    // Same traversal that also reports every address it loads to touch(const void*),
+    // used by the benchmark to model cache behaviour
+    template<typename PrimFn, typename TouchFn>
+    void intersect(const Ray& ray, float& closestT, PrimFn&& intersectPrim, TouchFn&& touch) const;
+
+    // Same traversal handing over whole leaves, for owners that test all primitives of a leaf at once.
+    // Calls intersectLeaf(first, count) for every leaf reached, its primitives are getPrimIndices()[first, first + count).
+    // With RAY_ANY_HIT intersectLeaf returns whether it found a hit.
+    template<unsigned Flags = RAY_CLOSEST_HIT, typename LeafFn>
+    bool intersectLeaves(const Ray& ray, float& closestT, LeafFn&& intersectLeaf) const;
+
+    // Closest hit traversal for a tile of up to MAX_TILE_RAYS coherent rays enclosed by frustum, closestT holds
+    // one distance per ray. A node is first tested with the first ray that reached its parent. Only when that
+    // ray misses is the frustum tested, which culls the subtree for all rays at once, and then the remaining
+    // rays until one hits. Leaves call intersectPrim(primIdx, firstRay, endRay) for each primitive, rays
+    // outside [firstRay, endRay) missed the leaf, the others are expected to lower their closestT on a hit.
+    template<typename PrimFn>
+    void intersectTile(const Frustum& frustum, const Ray* rays, uint32_t rayCount, float* closestT,
+                       PrimFn&& intersectPrim) const;
+
+    // Closest hit traversal for a packet of coherent rays that walk the tree together. Every node is tested against
+    // the rays still active in SIMD groups (see RayPacket.h) and only the rays that hit it stay active below it.
+    // Once a single ray is left the packet has diverged and that ray finishes the subtree on its own.
+    // Leaves call intersectPrim(primIdx, mask) for each primitive with the rays that reached them, which are
+    // expected to lower packet.closestT on a hit.
+    template<int N, typename PrimFn>
+    void intersectPacket(RayPacket<N>& packet, PacketMask active, PrimFn&& intersectPrim) const;
+
+    // Any hit traversal for shadow rays, intersect with RAY_ANY_HIT: stops as soon as occludesPrim(primIdx) returns true
+    template<typename PrimFn>
+    bool occluded(const Ray& ray, float tmax, PrimFn&& occludesPrim) const;
+
+    // Any hit traversal for a packet, packet.closestT holds each ray's tmax. Leaves call occludesPrim(primIdx, mask),
+    // which returns the rays in mask that the primitive blocks. Blocked rays drop out of the packet, a single ray
+    // left finishes on its own like in intersectPacket. Returns the blocked rays.
+    template<int N, typename PrimFn>
+    PacketMask occludedPacket(RayPacket<N>& packet, PacketMask active, PrimFn&& occludesPrim) const;
+
+    // Slab test, returns the entry distance or FLT_MAX on a miss
+    static float intersectAABB(const glm::vec3& origin, const glm::vec3& invDir,
+                               const glm::vec3& aabbMin, const glm::vec3& aabbMax, float closestT);
+
+    const std::vector<BVHNode>& getNodes() const { return nodes; }
+    const std::vector<uint32_t>& getPrimIndices() const { return primIndices; }
+    bool empty() const { return nodes.empty(); }
+    float getBuildTime() const { return buildTimeMs; } // Duration of the last build in ms
+    size_t memoryUsage() const { return nodes.size() * sizeof(BVHNode) + primIndices.size() * sizeof(uint32_t); }
+
+private:
+    static constexpr int BINS = 16;
+    static constexpr int MAX_DEPTH = 60; // Traversal stack is 64 deep
+    static constexpr uint32_t PARALLEL_BINNING_THRESHOLD = 1 << 16; // Bin nodes this big with all threads
+    static constexpr uint32_t PARALLEL_TASK_THRESHOLD = 1 << 12;    // Smaller subtrees stay on their thread
+    static constexpr float REBUILD_THRESHOLD = 1.5f; // Refitted trees this much worse than fresh ones get rebuilt
+    static constexpr uint32_t TREELET_NODES = 4096 / sizeof(BVHNode); // One page of nodes per treelet
+    static constexpr float SPATIAL_SPLIT_ALPHA = 1e-5f; // Only try spatial splits where children overlap more than this, relative to the root
+
+    struct Bin;
+    struct BuildContext;
+    struct Reference;
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> primIndices; // Leaves reference primitives through this array
+    float buildTimeMs = 0.0f;
+    float buildCost = 0.0f;
+    float currentCost = 0.0f;
+
+    void updateNodeBounds(BVHNode& node, const BuildContext& ctx) const;
+    void subdivide(uint32_t nodeIdx, BuildContext& ctx, int depth);
+    float findBestSplitPlane(const BVHNode& node, const BuildContext& ctx, const AABB& centroidBounds,
+                             int& axis, int& splitBin) const;
+
+    void refitNode(uint32_t nodeIdx, const std::vector<AABB>& primBounds);
+
+    template<unsigned Flags, typename LeafFn, typename TouchFn>
+    bool traverse(const Ray& ray, float& closestT, LeafFn&& intersectLeaf, TouchFn&& touch, uint32_t rootIdx = 0) const;
+
+    void buildSBVH(BuildContext& ctx);
+    void subdivideSpatial(uint32_t nodeIdx, std::vector<Reference> refs, BuildContext& ctx, int depth);
+    void makeLeaf(BVHNode& node, const std::vector<Reference>& refs, BuildContext& ctx);
+
+    void buildLBVH(BuildContext& ctx);
+    template<typename MortonCode>
+    void emitLBVH(uint32_t nodeIdx, const std::vector<MortonCode>& codes, uint32_t first, uint32_t last,
+                  BuildContext& ctx, int depth);
+};
+
+inline float BVH::intersectAABB(const glm::vec3& origin, const glm::vec3& invDir,
+                                const glm::vec3& aabbMin, const glm::vec3& aabbMax, float closestT)
+{
+    glm::vec3 t1 = (aabbMin - origin) * invDir;
+    glm::vec3 t2 = (aabbMax - origin) * invDir;
+    glm::vec3 tNear = glm::min(t1, t2);
+    glm::vec3 tFar = glm::max(t1, t2);
+    float tmin = glm::max(glm::max(tNear.x, tNear.y), tNear.z);
+    float tmax = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+
+    if (tmax >= tmin && tmin < closestT && tmax > 0.0f) return tmin;
+    return std::numeric_limits<float>::max();
+}
+
+// Test the primitives primIndices[first, first + count) of a leaf. Closest hits test all of them, with RAY_ANY_HIT
+// the first primitive testPrim reports as hit ends the leaf and true is returned.
+template<unsigned Flags, typename PrimFn>
+inline bool testLeafPrimitives(const uint32_t* primIndices, uint32_t first, uint32_t count, PrimFn& testPrim)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if constexpr ((Flags & RAY_ANY_HIT) != 0) {
+            if (testPrim(primIndices[first + i])) return true;
+        } else {
+            testPrim(primIndices[first + i]);
+        }
+    }
+    return false;
+}
+
+template<unsigned Flags, typename PrimFn>
+bool BVH::intersect(const Ray& ray, float& closestT, PrimFn&& testPrim) const
+{
+    return traverse<Flags>(ray, closestT, [&](uint32_t first, uint32_t count) {
+        return testLeafPrimitives<Flags>(primIndices.data(), first, count, testPrim);
+    }, [](const void*) {});
+}
+
+template<typename PrimFn, typename TouchFn>
+void BVH::intersect(const Ray& ray, float& closestT, PrimFn&& intersectPrim, TouchFn&& touch) const
+{
+    traverse<RAY_CLOSEST_HIT>(ray, closestT, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            touch(&primIndices[first + i]);
+            intersectPrim(primIndices[first + i]);
+        }
+    }, touch);
+}
+
+template<unsigned Flags, typename LeafFn>
+bool BVH::intersectLeaves(const Ray& ray, float& closestT, LeafFn&& intersectLeaf) const
+{
+    return traverse<Flags>(ray, closestT, intersectLeaf, [](const void*) {});
+}
+
+template<typename PrimFn>
+bool BVH::occluded(const Ray& ray, float tmax, PrimFn&& occludesPrim) const
+{
+    return intersect<RAY_ANY_HIT>(ray, tmax, occludesPrim);
+}
+
+template<unsigned Flags, typename LeafFn, typename TouchFn>
+bool BVH::traverse(const Ray& ray, float& closestT, LeafFn&& intersectLeaf, TouchFn&& touch, uint32_t rootIdx) const
+{
+    if (nodes.empty()) return false;
+
+    const glm::vec3& invDir = ray.invDirection;
+    const float miss = std::numeric_limits<float>::max();
+
+    const BVHNode* root = &nodes[rootIdx];
+    touch(root);
+    TRAVERSAL_STAT(boxTests, 1);
+    if (intersectAABB(ray.origin, invDir, root->aabbMin, root->aabbMax, closestT) == miss) return false;
+
+    const BVHNode* stack[64];
+    int stackPtr = 0;
+    const BVHNode* node = root;
+
+    while (true) {
+        if (node->isLeaf()) {
+            TRAVERSAL_STAT(primTests, node->primCount);
+            if constexpr ((Flags & RAY_ANY_HIT) != 0) {
+                if (intersectLeaf(node->leftFirst, node->primCount)) return true;
+            } else {
+                intersectLeaf(node->leftFirst, node->primCount);
+            }
+            if (stackPtr == 0) break;
+            node = stack[--stackPtr];
+            continue;
+        }
+
+        const BVHNode* child1 = &nodes[node->leftFirst];
+        const BVHNode* child2 = &nodes[node->leftFirst + 1];
+        touch(child1);
+        touch(child2);
+        TRAVERSAL_STAT(nodesVisited, 1);
+        TRAVERSAL_STAT(boxTests, 2);
+        float dist1 = intersectAABB(ray.origin, invDir, child1->aabbMin, child1->aabbMax, closestT);
+        float dist2 = intersectAABB(ray.origin, invDir, child2->aabbMin, child2->aabbMax, closestT);
+
+        // Closest hits visit the nearest child first so closestT shrinks as early as possible,
+        // any hit has nothing to converge on and only moves a missed child out of the way
+        bool swapChildren;
+        if constexpr ((Flags & RAY_ANY_HIT) != 0) {
+            swapChildren = dist1 == miss;
+        } else {
+            swapChildren = dist1 > dist2;
+        }
+        if (swapChildren) {
+            std::swap(dist1, dist2);
+            std::swap(child1, child2);
+        }
+
+        if (dist1 == miss) {
+            if (stackPtr == 0) break;
+            node = stack[--stackPtr];
+        } else {
+            node = child1;
+            if (dist2 != miss) stack[stackPtr++] = child2;
+        }
+    }
+    return false;
+}
+
+template<typename PrimFn>
+void BVH::intersectTile(const Frustum& frustum, const Ray* rays, uint32_t rayCount, float* closestT,
+                        PrimFn&& intersectPrim) const
+{
+    if (nodes.empty() || rayCount == 0) return;
+
+    const float miss = std::numeric_limits<float>::max();
+    auto rayHits = [&](uint32_t rayIdx, const BVHNode& node) {
+        TRAVERSAL_STAT(boxTests, 1);
+        return intersectAABB(rays[rayIdx].origin, rays[rayIdx].invDirection, node.aabbMin, node.aabbMax, closestT[rayIdx]) != miss;
+    };
+
+    // Every entry remembers the first ray that reached its parent, the rays before it are done with the subtree
+    struct StackEntry
+    {
+        const BVHNode* node;
+        uint32_t firstRay;
+    };
+    StackEntry stack[64];
+    int stackPtr = 0;
+    stack[stackPtr++] = {&nodes[0], 0};
+
+    while (stackPtr > 0) {
+        const StackEntry entry = stack[--stackPtr];
+        const BVHNode& node = *entry.node;
+        uint32_t firstRay = entry.firstRay;
+
+        if (!rayHits(firstRay, node)) {
+            TRAVERSAL_STAT(boxTests, 1);
+            if (!frustum.intersects(node.aabbMin, node.aabbMax)) continue;
+            for (firstRay++; firstRay < rayCount; firstRay++) {
+                if (rayHits(firstRay, node)) break;
+            }
+            if (firstRay == rayCount) continue;
+        }
+
+        if (node.isLeaf()) {
+            uint32_t endRay = rayCount;
+            while (endRay > firstRay + 1 && !rayHits(endRay - 1, node)) endRay--;
+
+            TRAVERSAL_STAT(primTests, node.primCount * (endRay - firstRay));
+            for (uint32_t i = 0; i < node.primCount; i++) {
+                intersectPrim(primIndices[node.leftFirst + i], firstRay, endRay);
+            }
+            continue;
+        }
+
+        // Front to back along the first ray, the rest of the tile looks roughly the same way
+        TRAVERSAL_STAT(nodesVisited, 1);
+        const BVHNode* nearChild = &nodes[node.leftFirst];
+        const BVHNode* farChild = nearChild + 1;
+        glm::vec3 offset = (farChild->aabbMin + farChild->aabbMax) - (nearChild->aabbMin + nearChild->aabbMax);
+        if (glm::dot(offset, rays[firstRay].direction) < 0.0f) std::swap(nearChild, farChild);
+        stack[stackPtr++] = {farChild, firstRay};
+        stack[stackPtr++] = {nearChild, firstRay};
+    }
+}
+
+template<int N, typename PrimFn>
+void BVH::intersectPacket(RayPacket<N>& packet, PacketMask active, PrimFn&& intersectPrim) const
+{
+    if (nodes.empty() || active == 0) return;
+
+    struct StackEntry
+    {
+        const BVHNode* node;
+        PacketMask mask; // Rays that hit the parent
+    };
+    StackEntry stack[64];
+    int stackPtr = 0;
+    stack[stackPtr++] = {&nodes[0], active};
+
+    while (stackPtr > 0) {
+        const StackEntry entry = stack[--stackPtr];
+        const BVHNode& node = *entry.node;
+
+        // Tested when popped instead of when pushed, closestT may have dropped in between
+        TRAVERSAL_STAT(boxTests, packetLaneCount(entry.mask));
+        PacketMask mask = intersectPacketAABB(packet, entry.mask, node.aabbMin, node.aabbMax);
+        if (mask == 0) continue;
+
+        if ((mask & (mask - 1)) == 0) {
+            int lane = 0;
+            while (!(mask & (PacketMask(1) << lane))) lane++;
+            traverse<RAY_CLOSEST_HIT>(packet.ray(lane), packet.closestT[lane], [&](uint32_t first, uint32_t count) {
+                for (uint32_t i = 0; i < count; i++) {
+                    intersectPrim(primIndices[first + i], mask);
+                }
+            }, [](const void*) {}, static_cast<uint32_t>(entry.node - nodes.data()));
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            TRAVERSAL_STAT(primTests, node.primCount * packetLaneCount(mask));
+            for (uint32_t i = 0; i < node.primCount; i++) {
+                intersectPrim(primIndices[node.leftFirst + i], mask);
+            }
+            continue;
+        }
+
+        // Front to back along the first active ray, like intersectTile
+        TRAVERSAL_STAT(nodesVisited, 1);
+        int lane = 0;
+        while (!(mask & (PacketMask(1) << lane))) lane++;
+        const BVHNode* nearChild = &nodes[node.leftFirst];
+        const BVHNode* farChild = nearChild + 1;
+        glm::vec3 offset = (farChild->aabbMin + farChild->aabbMax) - (nearChild->aabbMin + nearChild->aabbMax);
+        if (offset.x * packet.dx[lane] + offset.y * packet.dy[lane] + offset.z * packet.dz[lane] < 0.0f) {
+            std::swap(nearChild, farChild);
+        }
+        stack[stackPtr++] = {farChild, mask};
+        stack[stackPtr++] = {nearChild, mask};
+    }
+}
+
+template<int N, typename PrimFn>
+PacketMask BVH::occludedPacket(RayPacket<N>& packet, PacketMask active, PrimFn&& occludesPrim) const
+{
+    if (nodes.empty() || active == 0) return 0;
+
+    struct StackEntry
+    {
+        const BVHNode* node;
+        PacketMask mask;
+    };
+    StackEntry stack[64];
+    int stackPtr = 0;
+    stack[stackPtr++] = {&nodes[0], active};
+    PacketMask blocked = 0;
+
+    while (stackPtr > 0 && blocked != active) {
+        const StackEntry entry = stack[--stackPtr];
+        const BVHNode& node = *entry.node;
+
+        PacketMask mask = entry.mask & ~blocked;
+        if (mask == 0) continue;
+        TRAVERSAL_STAT(boxTests, packetLaneCount(mask));
+        mask = intersectPacketAABB(packet, mask, node.aabbMin, node.aabbMax);
+        if (mask == 0) continue;
+
+        if ((mask & (mask - 1)) == 0) {
+            int lane = 0;
+            while (!(mask & (PacketMask(1) << lane))) lane++;
+            auto occludesLane = [&](uint32_t primIdx) { return occludesPrim(primIdx, mask) != 0; };
+            uint32_t nodeIdx = static_cast<uint32_t>(entry.node - nodes.data());
+            float tmax = packet.closestT[lane];
+            bool hit = traverse<RAY_ANY_HIT>(packet.ray(lane), tmax, [&](uint32_t first, uint32_t count) {
+                return testLeafPrimitives<RAY_ANY_HIT>(primIndices.data(), first, count, occludesLane);
+            }, [](const void*) {}, nodeIdx);
+            if (hit) blocked |= mask;
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            TRAVERSAL_STAT(primTests, node.primCount * packetLaneCount(mask));
+            for (uint32_t i = 0; i < node.primCount && mask != 0; i++) {
+                PacketMask hit = occludesPrim(primIndices[node.leftFirst + i], mask);
+                blocked |= hit;
+                mask &= ~hit;
+            }
+            continue;
+        }
+
+        TRAVERSAL_STAT(nodesVisited, 1);
+        stack[stackPtr++] = {&nodes[node.leftFirst + 1], mask};
+        stack[stackPtr++] = {&nodes[node.leftFirst], mask};
+    }
+    return blocked;
+}
+
+#endif // BVH_H
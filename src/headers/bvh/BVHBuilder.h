@@ -0,0 +1,53 @@
+#ifndef BVHBUILDER_H
+#define BVHBUILDER_H
+
+// Builder internals shared by the BVH build modes, only included by the BVH sources
+
+#include <atomic>
+#include <vector>
+
+#include "BVH.h"
+
+struct BVH::Bin
+{
+    AABB bounds;
+    uint32_t count = 0;
+};
+
+// SBVH primitive reference, a primitive split by spatial splits has one reference per side
+struct BVH::Reference
+{
+    uint32_t primIdx;
+    AABB bounds; // Bounds of the part of the primitive this reference covers
+};
+
+// Everything the builder threads share while building
+struct BVH::BuildContext
+{
+    const std::vector<AABB>& bounds;
+    std::vector<glm::vec3> centroids;
+    unsigned threadCount;
+    uint32_t leafGroupSize = 1;
+    std::atomic<uint32_t> nodesUsed{0};
+    std::atomic<unsigned> activeTasks{1}; // The calling thread counts as one
+
+    // SBVH only
+    const PrimClipFn* clipPrim = nullptr;
+    float rootArea = 0.0f;
+    std::atomic<uint32_t> primsUsed{0};    // Leaves claim their range of primIndices from here
+    std::atomic<int64_t> splitBudget{0};   // References spatial splits may still add
+
+    // SAH intersection cost of count primitives, leaves are tested leafGroupSize primitives at a time
+    float primCost(uint32_t count) const { return static_cast<float>((count + leafGroupSize - 1) / leafGroupSize); }
+
+    // Claim a worker for a subtree task, false when every thread is already busy
+    bool tryStartTask()
+    {
+        if (activeTasks.fetch_add(1) < threadCount) return true;
+        activeTasks--;
+        return false;
+    }
+    void finishTask() { activeTasks--; }
+};
+
+#endif // BVHBUILDER_H
@@ -0,0 +1,58 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Primary rays are traced in square tiles of TILE_SIZE x TILE_SIZE pixels
+constexpr int TILE_SIZE = 8;
+constexpr uint32_t MAX_TILE_RAYS = 256; // Largest tile the tile traversals accept
+
+// Four planes through a shared ray origin that enclose every ray of a tile. Boxes entirely
+// outside one of the planes cannot be hit by any of those rays, so whole subtrees are culled
+// with one test instead of one test per ray.
+struct Frustum
+{
+    glm::vec4 planes[4]; // xyz normal pointing inwards, w offset: inside where dot(normal, p) + w >= 0
+
+    // Frustum spanned by the four corner rays of a tile, given in order around the tile.
+    // Rays between the corners are inside it as long as their directions interpolate the corners.
+    static Frustum fromCorners(const glm::vec3& origin, const glm::vec3 corners[4])
+    {
+        glm::vec3 center = corners[0] + corners[1] + corners[2] + corners[3];
+        Frustum frustum;
+        for (int i = 0; i < 4; i++) {
+            // A tile one pixel wide has two equal corners, the zero plane then accepts everything
+            glm::vec3 normal = glm::cross(corners[i], corners[(i + 1) & 3]);
+            if (glm::dot(normal, center) < 0.0f) normal = -normal;
+            frustum.planes[i] = glm::vec4(normal, -glm::dot(normal, origin));
+        }
+        return frustum;
+    }
+
+    // The same frustum in the object space of an instance placed with localToWorld. Planes move with the
+    // inverse transpose of the point transform, and the inverse of world to local is localToWorld itself.
+    Frustum transformed(const glm::mat4& localToWorld) const
+    {
+        Frustum frustum;
+        glm::mat4 planeTransform = glm::transpose(localToWorld);
+        for (int i = 0; i < 4; i++) {
+            frustum.planes[i] = planeTransform * planes[i];
+        }
+        return frustum;
+    }
+
+    // Conservative: false only if the box lies completely outside one plane
+    bool intersects(const glm::vec3& aabbMin, const glm::vec3& aabbMax) const
+    {
+        for (int i = 0; i < 4; i++) {
+            // The box corner furthest along the plane normal
+            glm::vec3 normal(planes[i]);
+            glm::vec3 corner = glm::mix(aabbMin, aabbMax, glm::greaterThan(normal, glm::vec3(0.0f)));
+            if (glm::dot(normal, corner) + planes[i].w < 0.0f) return false;
+        }
+        return true;
+    }
+};
+
+#endif // FRUSTUM_H
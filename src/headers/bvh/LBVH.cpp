@@ -0,0 +1,156 @@
+#include "BVH.h"
+#include "BVHBuilder.h"
+#include "../Parallel.h"
+
+#include <future>
+
+namespace
+{
+    // Spread the lower 10 bits of v so there are two zero bits between each of them
+    uint32_t expandBits10(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // Same for the lower 21 bits into a 64 bit value
+    uint64_t expandBits21(uint64_t v)
+    {
+        v &= 0x1FFFFF;
+        v = (v | v << 32) & 0x1F00000000FFFFull;
+        v = (v | v << 16) & 0x1F0000FF0000FFull;
+        v = (v | v << 8) & 0x100F00F00F00F00Full;
+        v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+        v = (v | v << 2) & 0x1249249249249249ull;
+        return v;
+    }
+
+    // p is the position normalized to [0, 1] inside the scene bounds
+    void mortonCode(const glm::vec3& p, uint32_t& code)
+    {
+        glm::uvec3 q = glm::uvec3(glm::clamp(p * 1024.0f, 0.0f, 1023.0f));
+        code = (expandBits10(q.x) << 2) | (expandBits10(q.y) << 1) | expandBits10(q.z);
+    }
+
+    void mortonCode(const glm::vec3& p, uint64_t& code)
+    {
+        glm::uvec3 q = glm::uvec3(glm::clamp(p * 2097152.0f, 0.0f, 2097151.0f));
+        code = (expandBits21(q.x) << 2) | (expandBits21(q.y) << 1) | expandBits21(q.z);
+    }
+
+    int countLeadingZeros(uint64_t v)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return v == 0 ? 64 : __builtin_clzll(v);
+#else
+        int count = 0;
+        for (uint64_t bit = 1ull << 63; bit != 0 && (v & bit) == 0; bit >>= 1) count++;
+        return count;
+#endif
+    }
+
+    // Last index of the left half of [first, last], found where the highest differing code bit flips
+    template<typename MortonCode>
+    uint32_t findSplit(const std::vector<MortonCode>& codes, uint32_t first, uint32_t last)
+    {
+        MortonCode firstCode = codes[first];
+        MortonCode lastCode = codes[last];
+        if (firstCode == lastCode) return (first + last) / 2;
+
+        int commonPrefix = countLeadingZeros(firstCode ^ lastCode);
+
+        // Binary search for the last code that still shares more than commonPrefix bits with the first
+        uint32_t split = first;
+        uint32_t step = last - first;
+        do {
+            step = (step + 1) / 2;
+            uint32_t newSplit = split + step;
+            if (newSplit < last && countLeadingZeros(firstCode ^ codes[newSplit]) > commonPrefix) {
+                split = newSplit;
+            }
+        } while (step > 1);
+
+        return split;
+    }
+}
+
+void BVH::buildLBVH(BuildContext& ctx)
+{
+    const uint32_t primCount = static_cast<uint32_t>(primIndices.size());
+
+    // Quantize inside the centroid bounds so all code bits are used
+    std::vector<AABB> threadBounds(ctx.threadCount);
+    unsigned chunks = parallelChunks(primCount, ctx.threadCount, [&](size_t begin, size_t end, unsigned t) {
+        for (size_t i = begin; i < end; i++) {
+            threadBounds[t].grow(ctx.centroids[i]);
+        }
+    });
+    AABB centroidBounds;
+    for (unsigned t = 0; t < chunks; t++) {
+        centroidBounds.grow(threadBounds[t]);
+    }
+    glm::vec3 extent = centroidBounds.bmax - centroidBounds.bmin;
+    glm::vec3 invExtent = glm::vec3(1.0f) / glm::max(extent, glm::vec3(1e-20f));
+
+    // 30 bit codes sort in half the passes, past a million primitives 10 bits per axis
+    // start to produce many duplicate codes so switch to 63 bits
+    auto buildWithCodes = [&](auto codeType) {
+        using MortonCode = decltype(codeType);
+        std::vector<MortonCode> codes(primCount);
+        parallelFor(primCount, [&](size_t i) {
+            mortonCode((ctx.centroids[i] - centroidBounds.bmin) * invExtent, codes[i]);
+        }, ctx.threadCount);
+
+        parallelRadixSort(codes, primIndices, ctx.threadCount);
+        emitLBVH(0, codes, 0, primCount - 1, ctx, 0);
+    };
+
+    if (primCount > (1u << 20)) {
+        buildWithCodes(uint64_t(0));
+    } else {
+        buildWithCodes(uint32_t(0));
+    }
+}
+
+template<typename MortonCode>
+void BVH::emitLBVH(uint32_t nodeIdx, const std::vector<MortonCode>& codes, uint32_t first, uint32_t last,
+                   BuildContext& ctx, int depth)
+{
+    BVHNode& node = nodes[nodeIdx];
+
+    if (first == last || depth >= MAX_DEPTH) {
+        node.leftFirst = first;
+        node.primCount = last - first + 1;
+        updateNodeBounds(node, ctx);
+        return;
+    }
+
+    uint32_t split = findSplit(codes, first, last);
+
+    uint32_t leftChildIdx = ctx.nodesUsed.fetch_add(2);
+    uint32_t rightChildIdx = leftChildIdx + 1;
+    node.leftFirst = leftChildIdx;
+    node.primCount = 0;
+
+    bool spawnTask = split - first + 1 >= PARALLEL_TASK_THRESHOLD && last - split >= PARALLEL_TASK_THRESHOLD;
+    if (spawnTask && ctx.tryStartTask()) {
+        auto leftTask = std::async(std::launch::async, [&]() {
+            emitLBVH(leftChildIdx, codes, first, split, ctx, depth + 1);
+            ctx.finishTask();
+        });
+        emitLBVH(rightChildIdx, codes, split + 1, last, ctx, depth + 1);
+        leftTask.wait();
+    } else {
+        emitLBVH(leftChildIdx, codes, first, split, ctx, depth + 1);
+        emitLBVH(rightChildIdx, codes, split + 1, last, ctx, depth + 1);
+    }
+
+    // Bounds are merged on the way back up, so every node is touched exactly once
+    const BVHNode& left = nodes[leftChildIdx];
+    const BVHNode& right = nodes[rightChildIdx];
+    node.aabbMin = glm::min(left.aabbMin, right.aabbMin);
+    node.aabbMax = glm::max(left.aabbMax, right.aabbMax);
+}
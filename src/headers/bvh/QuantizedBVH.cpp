@@ -0,0 +1,75 @@
+#include "QuantizedBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+template<int N>
+void QuantizedBVH<N>::build(const BVH& bvh)
+{
+    // Quantize the float wide tree node by node, the topology stays the same
+    WideBVH<N> wide;
+    wide.build(bvh);
+    primIndices = wide.getPrimIndices();
+
+    const std::vector<WideBVHNode<N>>& wideNodes = wide.getNodes();
+    nodes.resize(wideNodes.size());
+
+    for (size_t n = 0; n < wideNodes.size(); n++) {
+        const WideBVHNode<N>& src = wideNodes[n];
+        QuantizedBVHNode<N>& dst = nodes[n];
+
+        // The grid spans the union of the children
+        glm::vec3 nodeMin(std::numeric_limits<float>::max());
+        glm::vec3 nodeMax(-std::numeric_limits<float>::max());
+        for (int i = 0; i < N; i++) {
+            if (src.child[i] == WIDE_BVH_EMPTY) continue;
+            nodeMin = glm::min(nodeMin, glm::vec3(src.minX[i], src.minY[i], src.minZ[i]));
+            nodeMax = glm::max(nodeMax, glm::vec3(src.maxX[i], src.maxY[i], src.maxZ[i]));
+        }
+
+        dst.origin = nodeMin;
+        dst.pad = 0;
+        for (int a = 0; a < 3; a++) {
+            // Smallest power of two cell size for which 255 cells still cover the node
+            float extent = nodeMax[a] - nodeMin[a];
+            int exponent = extent > 0.0f ? static_cast<int>(std::ceil(std::log2(extent / 255.0f))) : -126;
+            exponent = std::clamp(exponent, -126, 127);
+            while (exponent < 127 && nodeMin[a] + 255.0f * std::ldexp(1.0f, exponent) < nodeMax[a]) exponent++;
+            dst.exponent[a] = static_cast<int8_t>(exponent);
+        }
+
+        for (int i = 0; i < N; i++) {
+            dst.child[i] = src.child[i];
+            dst.count[i] = src.count[i];
+
+            if (src.child[i] == WIDE_BVH_EMPTY) {
+                dst.qMinX[i] = dst.qMinY[i] = dst.qMinZ[i] = 0;
+                dst.qMaxX[i] = dst.qMaxY[i] = dst.qMaxZ[i] = 0;
+                continue;
+            }
+
+            const float childMin[3] = {src.minX[i], src.minY[i], src.minZ[i]};
+            const float childMax[3] = {src.maxX[i], src.maxY[i], src.maxZ[i]};
+            uint8_t* qMin[3] = {&dst.qMinX[i], &dst.qMinY[i], &dst.qMinZ[i]};
+            uint8_t* qMax[3] = {&dst.qMaxX[i], &dst.qMaxY[i], &dst.qMaxZ[i]};
+
+            for (int a = 0; a < 3; a++) {
+                float cell = dst.cellSize(a);
+                float origin = dst.origin[a];
+
+                // Round outwards, then step further if float rounding still put the plane inside the child
+                int lo = std::clamp(static_cast<int>(std::floor((childMin[a] - origin) / cell)), 0, 255);
+                int hi = std::clamp(static_cast<int>(std::ceil((childMax[a] - origin) / cell)), 0, 255);
+                while (lo > 0 && origin + lo * cell > childMin[a]) lo--;
+                while (hi < 255 && origin + hi * cell < childMax[a]) hi++;
+
+                *qMin[a] = static_cast<uint8_t>(lo);
+                *qMax[a] = static_cast<uint8_t>(hi);
+            }
+        }
+    }
+}
+
+template class QuantizedBVH<2>;
+template class QuantizedBVH<4>;
+template class QuantizedBVH<8>;
@@ -0,0 +1,182 @@
+#ifndef QUANTIZEDBVH_H
+#define QUANTIZEDBVH_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "WideBVH.h"
+
+// Wide node with the child bounds stored as 8 bit grid coordinates inside the node's own box.
+// The grid has 255 cells per axis with a power of two cell size, so decoding is a multiply and add.
+template<int N>
+struct QuantizedBVHNode
+{
+    glm::vec3 origin;   // Lower corner of the node
+    int8_t exponent[3]; // Cell size per axis is 2^exponent
+    uint8_t pad;
+    uint8_t qMinX[N], qMinY[N], qMinZ[N];
+    uint8_t qMaxX[N], qMaxY[N], qMaxZ[N];
+    uint32_t child[N]; // Same meaning as in WideBVHNode
+    uint32_t count[N];
+
+    float cellSize(int axis) const
+    {
+        uint32_t bits = static_cast<uint32_t>(exponent[axis] + 127) << 23;
+        float size;
+        std::memcpy(&size, &bits, sizeof(size));
+        return size;
+    }
+};
+
+// Box test on quantized children. Rather than decoding the bounds, the ray is moved into the
+// node's grid so every slab distance becomes q * cellSize * invDir + (origin - rayOrigin) * invDir.
+template<int N>
+struct QuantizedBoxTest
+{
+    static int intersect(const QuantizedBVHNode<N>& node, const WideRay& ray, float closestT, float* dist)
+    {
+        glm::vec3 scale(node.cellSize(0), node.cellSize(1), node.cellSize(2));
+        glm::vec3 a = scale * ray.invDir;
+        glm::vec3 b = (node.origin - ray.origin) * ray.invDir;
+
+        int mask = 0;
+        for (int i = 0; i < N; i++) {
+            float tx1 = node.qMinX[i] * a.x + b.x, tx2 = node.qMaxX[i] * a.x + b.x;
+            float ty1 = node.qMinY[i] * a.y + b.y, ty2 = node.qMaxY[i] * a.y + b.y;
+            float tz1 = node.qMinZ[i] * a.z + b.z, tz2 = node.qMaxZ[i] * a.z + b.z;
+            float tmin = glm::max(glm::max(glm::min(tx1, tx2), glm::min(ty1, ty2)), glm::max(glm::min(tz1, tz2), 0.0f));
+            float tmax = glm::min(glm::min(glm::max(tx1, tx2), glm::max(ty1, ty2)), glm::min(glm::max(tz1, tz2), closestT));
+            dist[i] = tmin;
+            if (tmin <= tmax) mask |= 1 << i;
+        }
+        return mask;
+    }
+};
+
+#if defined(__SSE__) || defined(_M_X64)
+template<>
+struct QuantizedBoxTest<4>
+{
+    // Widen 4 bytes to 4 floats with SSE2 only
+    static __m128 load(const uint8_t* q)
+    {
+        int32_t packed;
+        std::memcpy(&packed, q, sizeof(packed));
+        const __m128i zero = _mm_setzero_si128();
+        __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+        return _mm_cvtepi32_ps(v);
+    }
+
+    static int intersect(const QuantizedBVHNode<4>& node, const WideRay& ray, float closestT, float* dist)
+    {
+        const __m128 ax = _mm_set1_ps(node.cellSize(0) * ray.invDir.x);
+        const __m128 ay = _mm_set1_ps(node.cellSize(1) * ray.invDir.y);
+        const __m128 az = _mm_set1_ps(node.cellSize(2) * ray.invDir.z);
+        const __m128 bx = _mm_set1_ps((node.origin.x - ray.origin.x) * ray.invDir.x);
+        const __m128 by = _mm_set1_ps((node.origin.y - ray.origin.y) * ray.invDir.y);
+        const __m128 bz = _mm_set1_ps((node.origin.z - ray.origin.z) * ray.invDir.z);
+
+        __m128 tx1 = _mm_add_ps(_mm_mul_ps(load(node.qMinX), ax), bx);
+        __m128 tx2 = _mm_add_ps(_mm_mul_ps(load(node.qMaxX), ax), bx);
+        __m128 ty1 = _mm_add_ps(_mm_mul_ps(load(node.qMinY), ay), by);
+        __m128 ty2 = _mm_add_ps(_mm_mul_ps(load(node.qMaxY), ay), by);
+        __m128 tz1 = _mm_add_ps(_mm_mul_ps(load(node.qMinZ), az), bz);
+        __m128 tz2 = _mm_add_ps(_mm_mul_ps(load(node.qMaxZ), az), bz);
+
+        __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)),
+                                 _mm_max_ps(_mm_min_ps(tz1, tz2), _mm_setzero_ps()));
+        __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)),
+                                 _mm_min_ps(_mm_max_ps(tz1, tz2), _mm_set1_ps(closestT)));
+
+        _mm_storeu_ps(dist, tmin);
+        return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+    }
+};
+#endif
+
+#if defined(__AVX2__)
+template<>
+struct QuantizedBoxTest<8>
+{
+    static __m256 load(const uint8_t* q)
+    {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q))));
+    }
+
+    static int intersect(const QuantizedBVHNode<8>& node, const WideRay& ray, float closestT, float* dist)
+    {
+        const __m256 ax = _mm256_set1_ps(node.cellSize(0) * ray.invDir.x);
+        const __m256 ay = _mm256_set1_ps(node.cellSize(1) * ray.invDir.y);
+        const __m256 az = _mm256_set1_ps(node.cellSize(2) * ray.invDir.z);
+        const __m256 bx = _mm256_set1_ps((node.origin.x - ray.origin.x) * ray.invDir.x);
+        const __m256 by = _mm256_set1_ps((node.origin.y - ray.origin.y) * ray.invDir.y);
+        const __m256 bz = _mm256_set1_ps((node.origin.z - ray.origin.z) * ray.invDir.z);
+
+        __m256 tx1 = _mm256_add_ps(_mm256_mul_ps(load(node.qMinX), ax), bx);
+        __m256 tx2 = _mm256_add_ps(_mm256_mul_ps(load(node.qMaxX), ax), bx);
+        __m256 ty1 = _mm256_add_ps(_mm256_mul_ps(load(node.qMinY), ay), by);
+        __m256 ty2 = _mm256_add_ps(_mm256_mul_ps(load(node.qMaxY), ay), by);
+        __m256 tz1 = _mm256_add_ps(_mm256_mul_ps(load(node.qMinZ), az), bz);
+        __m256 tz2 = _mm256_add_ps(_mm256_mul_ps(load(node.qMaxZ), az), bz);
+
+        __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)),
+                                    _mm256_max_ps(_mm256_min_ps(tz1, tz2), _mm256_setzero_ps()));
+        __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)),
+                                    _mm256_min_ps(_mm256_max_ps(tz1, tz2), _mm256_set1_ps(closestT)));
+
+        _mm256_storeu_ps(dist, tmin);
+        return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+    }
+};
+#endif
+
+// Compressed version of WideBVH<N>, N = 2 gives a compressed binary tree.
+// Decoded bounds are always conservative, a child can only grow by less than one grid cell.
+template<int N>
+class QuantizedBVH
+{
+public:
+    QuantizedBVH() {};
+
+    void build(const BVH& bvh);
+
+    // Same contract as BVH::intersect
+    template<unsigned Flags = RAY_CLOSEST_HIT, typename PrimFn>
+    bool intersect(const Ray& ray, float& closestT, PrimFn&& testPrim) const
+    {
+        return intersectLeaves<Flags>(ray, closestT, [&](uint32_t first, uint32_t count) {
+            return testLeafPrimitives<Flags>(primIndices.data(), first, count, testPrim);
+        });
+    }
+
+    // Same contract as BVH::intersectLeaves
+    template<unsigned Flags = RAY_CLOSEST_HIT, typename LeafFn>
+    bool intersectLeaves(const Ray& ray, float& closestT, LeafFn&& intersectLeaf) const
+    {
+        return traverseWide<N, QuantizedBVHNode<N>, QuantizedBoxTest<N>, Flags>(nodes, ray, closestT, intersectLeaf);
+    }
+
+    // Same contract as BVH::occluded
+    template<typename PrimFn>
+    bool occluded(const Ray& ray, float tmax, PrimFn&& occludesPrim) const
+    {
+        return intersect<RAY_ANY_HIT>(ray, tmax, occludesPrim);
+    }
+
+    const std::vector<QuantizedBVHNode<N>>& getNodes() const { return nodes; }
+    bool empty() const { return nodes.empty(); }
+    void clear() { nodes.clear(); primIndices.clear(); }
+    size_t memoryUsage() const { return nodes.size() * sizeof(QuantizedBVHNode<N>) + primIndices.size() * sizeof(uint32_t); }
+
+private:
+    std::vector<QuantizedBVHNode<N>> nodes;
+    std::vector<uint32_t> primIndices;
+};
+
+using QuantizedBVH2 = QuantizedBVH<2>;
+using QuantizedBVH4 = QuantizedBVH<4>;
+using QuantizedBVH8 = QuantizedBVH<8>;
+
+#endif // QUANTIZEDBVH_H
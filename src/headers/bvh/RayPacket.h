@@ -0,0 +1,287 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "../Ray.h"
+
+// Bit i stands for ray i of a packet
+using PacketMask = uint64_t;
+
+// Rays a SIMD packet test handles at once
+#if defined(__AVX__)
+constexpr int PACKET_GROUP = 8;
+#elif defined(__SSE__) || defined(_M_X64)
+constexpr int PACKET_GROUP = 4;
+#else
+constexpr int PACKET_GROUP = 1;
+#endif
+
+// N coherent rays (16 for a 4x4 tile, 64 for 8x8) with every component in its own array,
+// so the packet tests below run PACKET_GROUP rays per instruction
+template<int N>
+struct alignas(32) RayPacket
+{
+    static_assert(N % 8 == 0 && N <= 64, "packets hold a multiple of 8 and at most 64 rays");
+
+    float ox[N], oy[N], oz[N];
+    float dx[N], dy[N], dz[N];
+    float invDx[N], invDy[N], invDz[N];
+    float tmin[N];     // Primitive hits must lie beyond it, like Ray::tmin
+    float closestT[N]; // Lowered by the primitive tests like closestT in BVH::intersect
+
+    static constexpr PacketMask lanes(uint32_t rayCount)
+    {
+        return rayCount >= 64 ? ~PacketMask(0) : (PacketMask(1) << rayCount) - 1;
+    }
+
+    // closestT starts at ray.tmax
+    void set(int lane, const Ray& ray)
+    {
+        ox[lane] = ray.origin.x; oy[lane] = ray.origin.y; oz[lane] = ray.origin.z;
+        dx[lane] = ray.direction.x; dy[lane] = ray.direction.y; dz[lane] = ray.direction.z;
+        invDx[lane] = ray.invDirection.x; invDy[lane] = ray.invDirection.y; invDz[lane] = ray.invDirection.z;
+        tmin[lane] = ray.tmin;
+        closestT[lane] = ray.tmax;
+    }
+
+    Ray ray(int lane) const
+    {
+        return Ray({ox[lane], oy[lane], oz[lane]}, {dx[lane], dy[lane], dz[lane]}, invDir(lane), tmin[lane], closestT[lane]);
+    }
+    glm::vec3 invDir(int lane) const { return {invDx[lane], invDy[lane], invDz[lane]}; }
+};
+
+// Number of rays in a mask, for the traversal counters
+inline int packetLaneCount(PacketMask mask)
+{
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1) count++;
+    return count;
+}
+
+// Tests of W consecutive rays of a packet starting at lane first, each returns a W bit mask.
+// box: the rays hitting the box closer than their closestT, same rule as BVH::intersectAABB.
+// triangle: Moller-Trumbore for the rays in laneMask against a TriangleHot (anything with v0, edge1
+// and edge2), hits in (tmin, closestT) lower closestT and write t, u and v at the lane index. Specialized for SSE and AVX below.
+template<int W>
+struct PacketGroupTest
+{
+    template<int N>
+    static uint32_t box(const RayPacket<N>& packet, int first, const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+    {
+        uint32_t mask = 0;
+        for (int i = first; i < first + W; i++) {
+            float tx1 = (aabbMin.x - packet.ox[i]) * packet.invDx[i], tx2 = (aabbMax.x - packet.ox[i]) * packet.invDx[i];
+            float ty1 = (aabbMin.y - packet.oy[i]) * packet.invDy[i], ty2 = (aabbMax.y - packet.oy[i]) * packet.invDy[i];
+            float tz1 = (aabbMin.z - packet.oz[i]) * packet.invDz[i], tz2 = (aabbMax.z - packet.oz[i]) * packet.invDz[i];
+            float tmin = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+            float tmax = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+            if (tmax >= tmin && tmin < packet.closestT[i] && tmax > 0.0f) mask |= 1u << (i - first);
+        }
+        return mask;
+    }
+
+    template<int N, typename Tri>
+    static uint32_t triangle(RayPacket<N>& packet, int first, uint32_t laneMask, const Tri& triangle,
+                             float* t, float* u, float* v)
+    {
+        uint32_t mask = 0;
+        for (int i = first; i < first + W; i++) {
+            if (!(laneMask & (1u << (i - first)))) continue;
+            float laneT, laneU, laneV;
+            if (triangle.intersect(packet.ray(i), packet.closestT[i], laneT, laneU, laneV)) {
+                packet.closestT[i] = t[i] = laneT;
+                u[i] = laneU;
+                v[i] = laneV;
+                mask |= 1u << (i - first);
+            }
+        }
+        return mask;
+    }
+};
+
+#if defined(__SSE__) || defined(_M_X64)
+template<>
+struct PacketGroupTest<4>
+{
+    template<int N>
+    static uint32_t box(const RayPacket<N>& packet, int first, const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+    {
+        const __m128 ox = _mm_load_ps(packet.ox + first), oy = _mm_load_ps(packet.oy + first), oz = _mm_load_ps(packet.oz + first);
+        const __m128 ix = _mm_load_ps(packet.invDx + first), iy = _mm_load_ps(packet.invDy + first), iz = _mm_load_ps(packet.invDz + first);
+
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabbMin.x), ox), ix), tx2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabbMax.x), ox), ix);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabbMin.y), oy), iy), ty2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabbMax.y), oy), iy);
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabbMin.z), oz), iz), tz2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabbMax.z), oz), iz);
+        __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+        __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmplt_ps(tmin, _mm_load_ps(packet.closestT + first)));
+        hit = _mm_and_ps(hit, _mm_cmpgt_ps(tmax, _mm_setzero_ps()));
+        return static_cast<uint32_t>(_mm_movemask_ps(hit));
+    }
+
+    template<int N, typename Tri>
+    static uint32_t triangle(RayPacket<N>& packet, int first, uint32_t laneMask, const Tri& triangle,
+                             float* t, float* u, float* v)
+    {
+        const __m128 dx = _mm_load_ps(packet.dx + first), dy = _mm_load_ps(packet.dy + first), dz = _mm_load_ps(packet.dz + first);
+        const __m128 e1x = _mm_set1_ps(triangle.edge1.x), e1y = _mm_set1_ps(triangle.edge1.y), e1z = _mm_set1_ps(triangle.edge1.z);
+        const __m128 e2x = _mm_set1_ps(triangle.edge2.x), e2y = _mm_set1_ps(triangle.edge2.y), e2z = _mm_set1_ps(triangle.edge2.z);
+
+        // h = cross(direction, edge2), a = dot(edge1, h)
+        __m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+        __m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+        __m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+        __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+        __m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+
+        __m128 sx = _mm_sub_ps(_mm_load_ps(packet.ox + first), _mm_set1_ps(triangle.v0.x));
+        __m128 sy = _mm_sub_ps(_mm_load_ps(packet.oy + first), _mm_set1_ps(triangle.v0.y));
+        __m128 sz = _mm_sub_ps(_mm_load_ps(packet.oz + first), _mm_set1_ps(triangle.v0.z));
+        __m128 laneU = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+
+        // q = cross(s, edge1)
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+        __m128 laneV = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+        __m128 laneT = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        const __m128 closestT = _mm_load_ps(packet.closestT + first);
+        __m128 valid = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), a), _mm_set1_ps(1e-8f));
+        valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(laneU, zero), _mm_cmple_ps(laneU, one)));
+        valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(laneV, zero), _mm_cmple_ps(_mm_add_ps(laneU, laneV), one)));
+        valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(laneT, _mm_load_ps(packet.tmin + first)), _mm_cmplt_ps(laneT, closestT)));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(valid)) & laneMask;
+        if (mask == 0) return 0;
+
+        // Lanes outside laneMask keep everything they had
+        const __m128 write = _mm_castsi128_ps(_mm_set_epi32(mask & 8 ? -1 : 0, mask & 4 ? -1 : 0, mask & 2 ? -1 : 0, mask & 1 ? -1 : 0));
+        auto blend = [&](float* dst, __m128 value) {
+            __m128 old = _mm_loadu_ps(dst);
+            _mm_storeu_ps(dst, _mm_or_ps(_mm_and_ps(write, value), _mm_andnot_ps(write, old)));
+        };
+        blend(packet.closestT + first, laneT);
+        blend(t + first, laneT);
+        blend(u + first, laneU);
+        blend(v + first, laneV);
+        return mask;
+    }
+};
+#endif
+
+#if defined(__AVX__)
+template<>
+struct PacketGroupTest<8>
+{
+    template<int N>
+    static uint32_t box(const RayPacket<N>& packet, int first, const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+    {
+        const __m256 ox = _mm256_load_ps(packet.ox + first), oy = _mm256_load_ps(packet.oy + first), oz = _mm256_load_ps(packet.oz + first);
+        const __m256 ix = _mm256_load_ps(packet.invDx + first), iy = _mm256_load_ps(packet.invDy + first), iz = _mm256_load_ps(packet.invDz + first);
+
+        __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aabbMin.x), ox), ix), tx2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aabbMax.x), ox), ix);
+        __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aabbMin.y), oy), iy), ty2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aabbMax.y), oy), iy);
+        __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aabbMin.z), oz), iz), tz2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aabbMax.z), oz), iz);
+        __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2));
+        __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2));
+
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ),
+                                   _mm256_cmp_ps(tmin, _mm256_load_ps(packet.closestT + first), _CMP_LT_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(tmax, _mm256_setzero_ps(), _CMP_GT_OQ));
+        return static_cast<uint32_t>(_mm256_movemask_ps(hit));
+    }
+
+    template<int N, typename Tri>
+    static uint32_t triangle(RayPacket<N>& packet, int first, uint32_t laneMask, const Tri& triangle,
+                             float* t, float* u, float* v)
+    {
+        const __m256 dx = _mm256_load_ps(packet.dx + first), dy = _mm256_load_ps(packet.dy + first), dz = _mm256_load_ps(packet.dz + first);
+        const __m256 e1x = _mm256_set1_ps(triangle.edge1.x), e1y = _mm256_set1_ps(triangle.edge1.y), e1z = _mm256_set1_ps(triangle.edge1.z);
+        const __m256 e2x = _mm256_set1_ps(triangle.edge2.x), e2y = _mm256_set1_ps(triangle.edge2.y), e2z = _mm256_set1_ps(triangle.edge2.z);
+
+        // h = cross(direction, edge2), a = dot(edge1, h)
+        __m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+        __m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+        __m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+        __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+        __m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+
+        __m256 sx = _mm256_sub_ps(_mm256_load_ps(packet.ox + first), _mm256_set1_ps(triangle.v0.x));
+        __m256 sy = _mm256_sub_ps(_mm256_load_ps(packet.oy + first), _mm256_set1_ps(triangle.v0.y));
+        __m256 sz = _mm256_sub_ps(_mm256_load_ps(packet.oz + first), _mm256_set1_ps(triangle.v0.z));
+        __m256 laneU = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+
+        // q = cross(s, edge1)
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+        __m256 laneV = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+        __m256 laneT = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+
+        const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+        const __m256 closestT = _mm256_load_ps(packet.closestT + first);
+        __m256 valid = _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a), _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+        valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(laneU, zero, _CMP_GE_OQ), _mm256_cmp_ps(laneU, one, _CMP_LE_OQ)));
+        valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(laneV, zero, _CMP_GE_OQ),
+                                                   _mm256_cmp_ps(_mm256_add_ps(laneU, laneV), one, _CMP_LE_OQ)));
+        valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(laneT, _mm256_load_ps(packet.tmin + first), _CMP_GT_OQ),
+                                                   _mm256_cmp_ps(laneT, closestT, _CMP_LT_OQ)));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(valid)) & laneMask;
+        if (mask == 0) return 0;
+
+        // Lanes outside laneMask keep everything they had
+        const __m256 write = _mm256_castsi256_ps(_mm256_set_epi32(mask & 128 ? -1 : 0, mask & 64 ? -1 : 0, mask & 32 ? -1 : 0,
+                                                                  mask & 16 ? -1 : 0, mask & 8 ? -1 : 0, mask & 4 ? -1 : 0,
+                                                                  mask & 2 ? -1 : 0, mask & 1 ? -1 : 0));
+        _mm256_store_ps(packet.closestT + first, _mm256_blendv_ps(closestT, laneT, write));
+        _mm256_storeu_ps(t + first, _mm256_blendv_ps(_mm256_loadu_ps(t + first), laneT, write));
+        _mm256_storeu_ps(u + first, _mm256_blendv_ps(_mm256_loadu_ps(u + first), laneU, write));
+        _mm256_storeu_ps(v + first, _mm256_blendv_ps(_mm256_loadu_ps(v + first), laneV, write));
+        return mask;
+    }
+};
+#endif
+
+// Rays in active that hit the box closer than their closestT, groups without an active ray are skipped
+template<int N>
+PacketMask intersectPacketAABB(const RayPacket<N>& packet, PacketMask active, const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+{
+    constexpr PacketMask groupBits = (PacketMask(1) << PACKET_GROUP) - 1;
+    PacketMask hit = 0;
+    for (int first = 0; first < N; first += PACKET_GROUP) {
+        PacketMask groupActive = (active >> first) & groupBits;
+        if (groupActive == 0) continue;
+        hit |= (PacketGroupTest<PACKET_GROUP>::box(packet, first, aabbMin, aabbMax) & groupActive) << first;
+    }
+    return hit;
+}
+
+// TriangleHot against the rays in active. Hits lower closestT and leave their t, u and v at the lane index
+// of the N sized arrays, the returned mask says which lanes were written.
+template<int N, typename Tri>
+PacketMask intersectPacketTriangle(RayPacket<N>& packet, PacketMask active, const Tri& triangle,
+                                   float* t, float* u, float* v)
+{
+    constexpr PacketMask groupBits = (PacketMask(1) << PACKET_GROUP) - 1;
+    PacketMask hit = 0;
+    for (int first = 0; first < N; first += PACKET_GROUP) {
+        uint32_t groupActive = static_cast<uint32_t>((active >> first) & groupBits);
+        if (groupActive == 0) continue;
+        hit |= PacketMask(PacketGroupTest<PACKET_GROUP>::triangle(packet, first, groupActive, triangle, t, u, v)) << first;
+    }
+    return hit;
+}
+
+#endif // RAYPACKET_H
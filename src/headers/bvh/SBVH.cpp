@@ -0,0 +1,246 @@
+#include "BVH.h"
+#include "BVHBuilder.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <future>
+
+namespace
+{
+    AABB intersectBounds(const AABB& a, const AABB& b)
+    {
+        return {glm::max(a.bmin, b.bmin), glm::min(a.bmax, b.bmax)};
+    }
+
+    // Box limited to [lo, hi] along axis
+    AABB slab(const AABB& bounds, int axis, float lo, float hi)
+    {
+        AABB result = bounds;
+        result.bmin[axis] = std::max(result.bmin[axis], lo);
+        result.bmax[axis] = std::min(result.bmax[axis], hi);
+        return result;
+    }
+
+    // First and last of binCount bins of width 1 / invBinWidth from nodeMin that bounds covers along axis.
+    // A reference ending exactly on a bin plane belongs to the bin left of it, so the bins the spatial split
+    // is costed with and the partition that carries it out put every reference on the same side.
+    void spatialBinRange(const AABB& bounds, int axis, float nodeMin, float invBinWidth, int binCount, int& firstBin, int& lastBin)
+    {
+        firstBin = std::clamp(static_cast<int>((bounds.bmin[axis] - nodeMin) * invBinWidth), 0, binCount - 1);
+        lastBin = std::clamp(static_cast<int>(std::ceil((bounds.bmax[axis] - nodeMin) * invBinWidth)) - 1, firstBin, binCount - 1);
+    }
+
+    struct SpatialBin
+    {
+        AABB bounds;
+        uint32_t entries = 0; // References starting in this bin
+        uint32_t exits = 0;   // References ending in this bin
+    };
+}
+
+void BVH::buildSBVH(BuildContext& ctx)
+{
+    const uint32_t primCount = static_cast<uint32_t>(ctx.bounds.size());
+
+    std::vector<Reference> refs(primCount);
+    AABB rootBounds;
+    for (uint32_t i = 0; i < primCount; i++) {
+        refs[i] = {i, ctx.bounds[i]};
+        rootBounds.grow(ctx.bounds[i]);
+    }
+    ctx.rootArea = rootBounds.area();
+
+    subdivideSpatial(0, std::move(refs), ctx, 0);
+}
+
+void BVH::makeLeaf(BVHNode& node, const std::vector<Reference>& refs, BuildContext& ctx)
+{
+    uint32_t first = ctx.primsUsed.fetch_add(static_cast<uint32_t>(refs.size()));
+    for (size_t i = 0; i < refs.size(); i++) {
+        primIndices[first + i] = refs[i].primIdx;
+    }
+    node.leftFirst = first;
+    node.primCount = static_cast<uint32_t>(refs.size());
+}
+
+void BVH::subdivideSpatial(uint32_t nodeIdx, std::vector<Reference> refs, BuildContext& ctx, int depth)
+{
+    BVHNode& node = nodes[nodeIdx];
+
+    AABB nodeBounds, centroidBounds;
+    for (const Reference& ref : refs) {
+        nodeBounds.grow(ref.bounds);
+        centroidBounds.grow(ref.bounds.centroid());
+    }
+    node.aabbMin = nodeBounds.bmin;
+    node.aabbMax = nodeBounds.bmax;
+
+    const uint32_t refCount = static_cast<uint32_t>(refs.size());
+    if (refCount <= 1 || depth >= MAX_DEPTH) {
+        makeLeaf(node, refs, ctx);
+        return;
+    }
+
+    // Object split, the same binned SAH the regular builder uses but over reference bounds
+    int objectAxis = -1, objectBin = 0;
+    float objectCost = std::numeric_limits<float>::max();
+    AABB objectLeft, objectRight;
+    {
+        glm::vec3 extent = centroidBounds.bmax - centroidBounds.bmin;
+        std::array<std::array<Bin, BINS>, 3> bins{};
+        for (const Reference& ref : refs) {
+            glm::vec3 c = ref.bounds.centroid();
+            for (int a = 0; a < 3; a++) {
+                if (extent[a] <= 0.0f) continue;
+                int binIdx = std::min(BINS - 1, static_cast<int>((c[a] - centroidBounds.bmin[a]) * (BINS / extent[a])));
+                bins[a][binIdx].count++;
+                bins[a][binIdx].bounds.grow(ref.bounds);
+            }
+        }
+
+        for (int a = 0; a < 3; a++) {
+            if (extent[a] <= 0.0f) continue;
+            for (int split = 0; split < BINS - 1; split++) {
+                AABB left, right;
+                uint32_t leftCount = 0, rightCount = 0;
+                for (int b = 0; b <= split; b++) { left.grow(bins[a][b].bounds); leftCount += bins[a][b].count; }
+                for (int b = split + 1; b < BINS; b++) { right.grow(bins[a][b].bounds); rightCount += bins[a][b].count; }
+                if (leftCount == 0 || rightCount == 0) continue;
+
+                float cost = ctx.primCost(leftCount) * left.area() + ctx.primCost(rightCount) * right.area();
+                if (cost < objectCost) {
+                    objectCost = cost;
+                    objectAxis = a;
+                    objectBin = split;
+                    objectLeft = left;
+                    objectRight = right;
+                }
+            }
+        }
+    }
+
+    // Spatial split, only worth the clipping when the object split children overlap noticeably
+    int spatialAxis = -1;
+    int spatialBin = 0; // Last bin on the left
+    float spatialCost = std::numeric_limits<float>::max();
+    float spatialPos = 0.0f;
+    AABB overlap = intersectBounds(objectLeft, objectRight);
+    bool trySpatial = ctx.splitBudget.load() > 0 &&
+                      (objectAxis < 0 || (!overlap.empty() && overlap.area() > SPATIAL_SPLIT_ALPHA * ctx.rootArea));
+    if (trySpatial) {
+        const PrimClipFn& clipPrim = *ctx.clipPrim;
+        glm::vec3 extent = nodeBounds.bmax - nodeBounds.bmin;
+
+        for (int a = 0; a < 3; a++) {
+            if (extent[a] <= 0.0f) continue;
+            const float binWidth = extent[a] / BINS;
+            const float invBinWidth = BINS / extent[a];
+
+            // Every reference is clipped to each bin it crosses, so the bins only grow by the part inside them
+            std::array<SpatialBin, BINS> bins;
+            for (const Reference& ref : refs) {
+                int firstBin, lastBin;
+                spatialBinRange(ref.bounds, a, nodeBounds.bmin[a], invBinWidth, BINS, firstBin, lastBin);
+                bins[firstBin].entries++;
+                bins[lastBin].exits++;
+
+                if (firstBin == lastBin) {
+                    bins[firstBin].bounds.grow(ref.bounds);
+                    continue;
+                }
+                for (int b = firstBin; b <= lastBin; b++) {
+                    float lo = nodeBounds.bmin[a] + b * binWidth;
+                    float hi = b == BINS - 1 ? nodeBounds.bmax[a] : lo + binWidth;
+                    AABB clipped = clipPrim(ref.primIdx, slab(ref.bounds, a, lo, hi));
+                    if (!clipped.empty()) bins[b].bounds.grow(intersectBounds(clipped, ref.bounds));
+                }
+            }
+
+            for (int split = 0; split < BINS - 1; split++) {
+                AABB left, right;
+                uint32_t leftCount = 0, rightCount = 0;
+                for (int b = 0; b <= split; b++) { left.grow(bins[b].bounds); leftCount += bins[b].entries; }
+                for (int b = split + 1; b < BINS; b++) { right.grow(bins[b].bounds); rightCount += bins[b].exits; }
+                if (leftCount == 0 || rightCount == 0) continue;
+
+                float cost = ctx.primCost(leftCount) * left.area() + ctx.primCost(rightCount) * right.area();
+                if (cost < spatialCost) {
+                    spatialCost = cost;
+                    spatialAxis = a;
+                    spatialBin = split;
+                    spatialPos = nodeBounds.bmin[a] + (split + 1) * binWidth;
+                }
+            }
+        }
+    }
+
+    float noSplitCost = ctx.primCost(refCount) * nodeBounds.area();
+    bool useSpatial = spatialAxis >= 0 && spatialCost < objectCost;
+    if (std::min(objectCost, spatialCost) >= noSplitCost || (!useSpatial && objectAxis < 0)) {
+        makeLeaf(node, refs, ctx);
+        return;
+    }
+
+    std::vector<Reference> leftRefs, rightRefs;
+    leftRefs.reserve(refCount);
+    rightRefs.reserve(refCount);
+
+    if (useSpatial) {
+        const PrimClipFn& clipPrim = *ctx.clipPrim;
+        const int a = spatialAxis;
+        const float invBinWidth = BINS / (nodeBounds.bmax[a] - nodeBounds.bmin[a]);
+        for (const Reference& ref : refs) {
+            // Sides by bin like in the cost above, comparing against spatialPos could round differently
+            int firstBin, lastBin;
+            spatialBinRange(ref.bounds, a, nodeBounds.bmin[a], invBinWidth, BINS, firstBin, lastBin);
+            if (lastBin <= spatialBin) {
+                leftRefs.push_back(ref);
+            } else if (firstBin > spatialBin) {
+                rightRefs.push_back(ref);
+            } else if (ctx.splitBudget.fetch_sub(1) > 0) {
+                // Straddling reference, each side keeps only the part of the primitive it contains
+                AABB left = intersectBounds(clipPrim(ref.primIdx, slab(ref.bounds, a, ref.bounds.bmin[a], spatialPos)), ref.bounds);
+                AABB right = intersectBounds(clipPrim(ref.primIdx, slab(ref.bounds, a, spatialPos, ref.bounds.bmax[a])), ref.bounds);
+                if (!left.empty()) leftRefs.push_back({ref.primIdx, left});
+                if (!right.empty()) rightRefs.push_back({ref.primIdx, right});
+                if (left.empty() && right.empty()) leftRefs.push_back(ref);
+            } else {
+                // Out of budget, the reference goes whole to the side holding its centroid
+                (ref.bounds.centroid()[a] < spatialPos ? leftRefs : rightRefs).push_back(ref);
+            }
+        }
+    } else {
+        float boundsMin = centroidBounds.bmin[objectAxis];
+        float scale = BINS / (centroidBounds.bmax[objectAxis] - boundsMin);
+        for (const Reference& ref : refs) {
+            int binIdx = std::min(BINS - 1, static_cast<int>((ref.bounds.centroid()[objectAxis] - boundsMin) * scale));
+            (binIdx <= objectBin ? leftRefs : rightRefs).push_back(ref);
+        }
+    }
+
+    if (leftRefs.empty() || rightRefs.empty()) {
+        makeLeaf(node, refs, ctx);
+        return;
+    }
+    refs.clear();
+    refs.shrink_to_fit();
+
+    uint32_t leftChildIdx = ctx.nodesUsed.fetch_add(2);
+    uint32_t rightChildIdx = leftChildIdx + 1;
+    node.leftFirst = leftChildIdx;
+    node.primCount = 0;
+
+    bool spawnTask = leftRefs.size() >= PARALLEL_TASK_THRESHOLD && rightRefs.size() >= PARALLEL_TASK_THRESHOLD;
+    if (spawnTask && ctx.tryStartTask()) {
+        auto leftTask = std::async(std::launch::async, [&]() {
+            subdivideSpatial(leftChildIdx, std::move(leftRefs), ctx, depth + 1);
+            ctx.finishTask();
+        });
+        subdivideSpatial(rightChildIdx, std::move(rightRefs), ctx, depth + 1);
+        leftTask.wait();
+    } else {
+        subdivideSpatial(leftChildIdx, std::move(leftRefs), ctx, depth + 1);
+        subdivideSpatial(rightChildIdx, std::move(rightRefs), ctx, depth + 1);
+    }
+}
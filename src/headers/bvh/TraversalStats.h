@@ -0,0 +1,40 @@
+#ifndef TRAVERSALSTATS_H
+#define TRAVERSALSTATS_H
+
+#include <cstdint>
+
+// Work done by the traversals, counted per thread. Only collected when the build defines
+// CONSTATINE_TRAVERSAL_STATS, otherwise TRAVERSAL_STAT compiles to nothing.
+struct TraversalStats
+{
+    uint64_t nodesVisited = 0; // Interior nodes whose children were tested
+    uint64_t boxTests = 0;     // Child bounds tested, N per wide node
+    uint64_t primTests = 0;    // Leaf primitives handed to the primitive test (triangles, spheres, instances)
+
+    uint64_t total() const { return nodesVisited + primTests; }
+
+    TraversalStats& operator+=(const TraversalStats& other)
+    {
+        nodesVisited += other.nodesVisited;
+        boxTests += other.boxTests;
+        primTests += other.primTests;
+        return *this;
+    }
+};
+
+// Counters of the calling thread, reset them before a ray to get the cost of that ray
+inline TraversalStats& traversalStats()
+{
+    thread_local TraversalStats stats;
+    return stats;
+}
+
+#ifdef CONSTATINE_TRAVERSAL_STATS
+#define TRAVERSAL_STATS_ENABLED 1
+#define TRAVERSAL_STAT(counter, amount) (traversalStats().counter += (amount))
+#else
+#define TRAVERSAL_STATS_ENABLED 0
+#define TRAVERSAL_STAT(counter, amount) ((void)0)
+#endif
+
+#endif // TRAVERSALSTATS_H
@@ -0,0 +1,85 @@
+#include "WideBVH.h"
+
+template<int N>
+void WideBVH<N>::build(const BVH& bvh)
+{
+    nodes.clear();
+    primIndices = bvh.getPrimIndices();
+
+    const std::vector<BVHNode>& binaryNodes = bvh.getNodes();
+    if (binaryNodes.empty()) return;
+
+    nodes.reserve(binaryNodes.size() / (N - 1) + 1);
+    nodes.emplace_back();
+    collapse(binaryNodes, 0, 0);
+    nodes.shrink_to_fit();
+}
+
+template<int N>
+void WideBVH<N>::collapse(const std::vector<BVHNode>& binaryNodes, uint32_t wideIdx, uint32_t binaryIdx)
+{
+    // Start from the two binary children and keep opening the largest interior one
+    uint32_t children[N];
+    int childCount = 0;
+    const BVHNode& binaryNode = binaryNodes[binaryIdx];
+    if (binaryNode.isLeaf()) {
+        children[childCount++] = binaryIdx; // Only happens for a root that is a single leaf
+    } else {
+        children[childCount++] = binaryNode.leftFirst;
+        children[childCount++] = binaryNode.leftFirst + 1;
+    }
+
+    while (childCount < N) {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int i = 0; i < childCount; i++) {
+            const BVHNode& child = binaryNodes[children[i]];
+            if (child.isLeaf()) continue;
+            float area = AABB{child.aabbMin, child.aabbMax}.area();
+            if (area > largestArea) {
+                largest = i;
+                largestArea = area;
+            }
+        }
+        if (largest < 0) break;
+
+        uint32_t opened = binaryNodes[children[largest]].leftFirst;
+        children[largest] = opened;
+        children[childCount++] = opened + 1;
+    }
+
+    for (int i = 0; i < N; i++) {
+        WideBVHNode<N>& node = nodes[wideIdx];
+        if (i >= childCount) {
+            node.minX[i] = node.minY[i] = node.minZ[i] = 0.0f;
+            node.maxX[i] = node.maxY[i] = node.maxZ[i] = 0.0f;
+            node.child[i] = WIDE_BVH_EMPTY;
+            node.count[i] = 0;
+            continue;
+        }
+
+        const BVHNode& child = binaryNodes[children[i]];
+        node.minX[i] = child.aabbMin.x;
+        node.minY[i] = child.aabbMin.y;
+        node.minZ[i] = child.aabbMin.z;
+        node.maxX[i] = child.aabbMax.x;
+        node.maxY[i] = child.aabbMax.y;
+        node.maxZ[i] = child.aabbMax.z;
+
+        if (child.isLeaf()) {
+            node.child[i] = child.leftFirst;
+            node.count[i] = child.primCount;
+        } else {
+            // emplace_back may move the nodes, so the reference is fetched again every iteration
+            uint32_t childIdx = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+            nodes[wideIdx].child[i] = childIdx;
+            nodes[wideIdx].count[i] = 0;
+            collapse(binaryNodes, childIdx, children[i]);
+        }
+    }
+}
+
+template class WideBVH<2>;
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -0,0 +1,258 @@
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "BVH.h"
+#include "../Ray.h"
+
+static constexpr uint32_t WIDE_BVH_EMPTY = 0xFFFFFFFF;
+
+// N children per node with their bounds stored as separate arrays per axis,
+// so one SIMD instruction sequence tests a ray against all N boxes at once
+template<int N>
+struct alignas(64) WideBVHNode
+{
+    float minX[N], maxX[N];
+    float minY[N], maxY[N];
+    float minZ[N], maxZ[N];
+    uint32_t child[N]; // Wide node index, or first entry in primIndices for a leaf child, WIDE_BVH_EMPTY for unused slots
+    uint32_t count[N]; // Primitive count of a leaf child, 0 for interior children
+};
+
+// Ray data prepared once per traversal so the box tests only load node data
+struct WideRay
+{
+    glm::vec3 origin;
+    glm::vec3 invDir;
+
+    // The ray's inverse direction is finite, quantized nodes scale it and 0 * inf would turn their box test into NaN
+    static WideRay fromRay(const Ray& ray) { return {ray.origin, ray.invDirection}; }
+};
+
+// Ray against all N child boxes of a node. Writes the entry distances to dist and returns a
+// bitmask of the children that are hit closer than closestT. Specialized for SSE and AVX below.
+template<int N>
+struct WideBoxTest
+{
+    static int intersect(const WideBVHNode<N>& node, const WideRay& ray, float closestT, float* dist)
+    {
+        int mask = 0;
+        for (int i = 0; i < N; i++) {
+            float tx1 = (node.minX[i] - ray.origin.x) * ray.invDir.x, tx2 = (node.maxX[i] - ray.origin.x) * ray.invDir.x;
+            float ty1 = (node.minY[i] - ray.origin.y) * ray.invDir.y, ty2 = (node.maxY[i] - ray.origin.y) * ray.invDir.y;
+            float tz1 = (node.minZ[i] - ray.origin.z) * ray.invDir.z, tz2 = (node.maxZ[i] - ray.origin.z) * ray.invDir.z;
+            float tmin = glm::max(glm::max(glm::min(tx1, tx2), glm::min(ty1, ty2)), glm::max(glm::min(tz1, tz2), 0.0f));
+            float tmax = glm::min(glm::min(glm::max(tx1, tx2), glm::max(ty1, ty2)), glm::min(glm::max(tz1, tz2), closestT));
+            dist[i] = tmin;
+            if (tmin <= tmax) mask |= 1 << i;
+        }
+        return mask;
+    }
+};
+
+#if defined(__SSE__) || defined(_M_X64)
+template<>
+struct WideBoxTest<4>
+{
+    static int intersect(const WideBVHNode<4>& node, const WideRay& ray, float closestT, float* dist)
+    {
+        const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+        const __m128 ix = _mm_set1_ps(ray.invDir.x), iy = _mm_set1_ps(ray.invDir.y), iz = _mm_set1_ps(ray.invDir.z);
+
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), ox), ix);
+        __m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), ox), ix);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), oy), iy);
+        __m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), oy), iy);
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), oz), iz);
+        __m128 tz2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), oz), iz);
+
+        __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)),
+                                 _mm_max_ps(_mm_min_ps(tz1, tz2), _mm_setzero_ps()));
+        __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)),
+                                 _mm_min_ps(_mm_max_ps(tz1, tz2), _mm_set1_ps(closestT)));
+
+        _mm_storeu_ps(dist, tmin);
+        return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+    }
+};
+#endif
+
+#if defined(__AVX__)
+template<>
+struct WideBoxTest<8>
+{
+    static int intersect(const WideBVHNode<8>& node, const WideRay& ray, float closestT, float* dist)
+    {
+        const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+        const __m256 ix = _mm256_set1_ps(ray.invDir.x), iy = _mm256_set1_ps(ray.invDir.y), iz = _mm256_set1_ps(ray.invDir.z);
+
+        __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minX), ox), ix);
+        __m256 tx2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxX), ox), ix);
+        __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minY), oy), iy);
+        __m256 ty2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxY), oy), iy);
+        __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minZ), oz), iz);
+        __m256 tz2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxZ), oz), iz);
+
+        __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)),
+                                    _mm256_max_ps(_mm256_min_ps(tz1, tz2), _mm256_setzero_ps()));
+        __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)),
+                                    _mm256_min_ps(_mm256_max_ps(tz1, tz2), _mm256_set1_ps(closestT)));
+
+        _mm256_storeu_ps(dist, tmin);
+        return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+    }
+};
+#endif
+
+// BVH with up to N children per node, collapsed from a binary BVH.
+// N = 2 keeps the binary topology but stores both children in their parent.
+template<int N>
+class WideBVH
+{
+public:
+    WideBVH() {};
+
+    // Collapse the binary tree, every wide node pulls in the largest binary descendants until it has N children
+    void build(const BVH& bvh);
+
+    // Same contract as BVH::intersect
+    template<unsigned Flags = RAY_CLOSEST_HIT, typename PrimFn>
+    bool intersect(const Ray& ray, float& closestT, PrimFn&& testPrim) const;
+
+    // Same contract as BVH::intersectLeaves, leaves keep the first and count of the binary leaf they came from
+    template<unsigned Flags = RAY_CLOSEST_HIT, typename LeafFn>
+    bool intersectLeaves(const Ray& ray, float& closestT, LeafFn&& intersectLeaf) const;
+
+    // Same contract as BVH::occluded
+    template<typename PrimFn>
+    bool occluded(const Ray& ray, float tmax, PrimFn&& occludesPrim) const;
+
+    const std::vector<WideBVHNode<N>>& getNodes() const { return nodes; }
+    const std::vector<uint32_t>& getPrimIndices() const { return primIndices; }
+    bool empty() const { return nodes.empty(); }
+    size_t memoryUsage() const { return nodes.size() * sizeof(WideBVHNode<N>) + primIndices.size() * sizeof(uint32_t); }
+    void clear() { nodes.clear(); primIndices.clear(); }
+
+private:
+    std::vector<WideBVHNode<N>> nodes;
+    std::vector<uint32_t> primIndices;
+
+    void collapse(const std::vector<BVHNode>& binaryNodes, uint32_t wideIdx, uint32_t binaryIdx);
+};
+
+using BVH2 = WideBVH<2>;
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+// Stack traversal shared by every wide node format. BoxTest::intersect(node, ray, closestT, dist)
+// returns the hit mask of the children, the nodes only need the child and count arrays.
+// Leaves are handed over whole as intersectLeaf(first, count), first indexing primIndices.
+// Flags work like in BVH::intersect: closest hits visit the children near to far, with RAY_ANY_HIT
+// they are pushed in slot order and the first leaf returning true ends the traversal.
+template<int N, typename Node, typename BoxTest, unsigned Flags = RAY_CLOSEST_HIT, typename LeafFn>
+bool traverseWide(const std::vector<Node>& nodes, const Ray& ray, float& closestT, LeafFn&& intersectLeaf)
+{
+    if (nodes.empty()) return false;
+    constexpr bool anyHit = (Flags & RAY_ANY_HIT) != 0;
+
+    struct StackEntry
+    {
+        uint32_t index; // Wide node, or first primitive when count > 0
+        uint32_t count;
+        float dist;
+    };
+
+    WideRay wideRay = WideRay::fromRay(ray);
+    StackEntry stack[64 * N];
+    int stackPtr = 0;
+    stack[stackPtr++] = {0, 0, 0.0f};
+
+    while (stackPtr > 0) {
+        const StackEntry entry = stack[--stackPtr];
+        if constexpr (!anyHit) {
+            if (entry.dist >= closestT) continue; // Something closer was found since this was pushed
+        }
+
+        if (entry.count > 0) {
+            TRAVERSAL_STAT(primTests, entry.count);
+            if constexpr (anyHit) {
+                if (intersectLeaf(entry.index, entry.count)) return true;
+            } else {
+                intersectLeaf(entry.index, entry.count);
+            }
+            continue;
+        }
+
+        const Node& node = nodes[entry.index];
+        alignas(32) float dist[N];
+        TRAVERSAL_STAT(nodesVisited, 1);
+        TRAVERSAL_STAT(boxTests, N);
+        int mask = BoxTest::intersect(node, wideRay, closestT, dist);
+
+        if constexpr (anyHit) {
+            while (mask) {
+                int i = 0;
+                while (!(mask & (1 << i))) i++;
+                mask &= ~(1 << i);
+                if (node.child[i] != WIDE_BVH_EMPTY) stack[stackPtr++] = {node.child[i], node.count[i], dist[i]};
+            }
+            continue;
+        }
+
+        // Sort the hit children far to near so the nearest ends up on top of the stack
+        StackEntry hits[N];
+        int hitCount = 0;
+        while (mask) {
+            int i = 0;
+            while (!(mask & (1 << i))) i++;
+            mask &= ~(1 << i);
+            if (node.child[i] == WIDE_BVH_EMPTY) continue;
+
+            StackEntry hit{node.child[i], node.count[i], dist[i]};
+            int j = hitCount++;
+            while (j > 0 && hits[j - 1].dist < hit.dist) {
+                hits[j] = hits[j - 1];
+                j--;
+            }
+            hits[j] = hit;
+        }
+        for (int i = 0; i < hitCount; i++) {
+            stack[stackPtr++] = hits[i];
+        }
+    }
+    return false;
+}
+
+template<int N>
+template<unsigned Flags, typename PrimFn>
+bool WideBVH<N>::intersect(const Ray& ray, float& closestT, PrimFn&& testPrim) const
+{
+    return intersectLeaves<Flags>(ray, closestT, [&](uint32_t first, uint32_t count) {
+        return testLeafPrimitives<Flags>(primIndices.data(), first, count, testPrim);
+    });
+}
+
+template<int N>
+template<unsigned Flags, typename LeafFn>
+bool WideBVH<N>::intersectLeaves(const Ray& ray, float& closestT, LeafFn&& intersectLeaf) const
+{
+    return traverseWide<N, WideBVHNode<N>, WideBoxTest<N>, Flags>(nodes, ray, closestT, intersectLeaf);
+}
+
+template<int N>
+template<typename PrimFn>
+bool WideBVH<N>::occluded(const Ray& ray, float tmax, PrimFn&& occludesPrim) const
+{
+    return intersect<RAY_ANY_HIT>(ray, tmax, occludesPrim);
+}
+
+#endif // WIDEBVH_H
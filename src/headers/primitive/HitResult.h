@@ -1,4 +1,9 @@
+#ifndef HITRESULT_H
+#define HITRESULT_H
+
 #include "glm/fwd.hpp"
+#include <cstdint>
+#include <limits>
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
 
@@ -10,3 +15,19 @@ struct HitResult
     glm::vec2 uv;     // Texture coordinates
     glm::vec3 color;  // Color at the intersection
 };
+
+// Compact hit kept during traversal. Shading (UVs, texture sample, normal) runs once per ray from it
+// after traversal, so hits a closer one replaces never read their shading data.
+struct HitRecord
+{
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+
+    float t = std::numeric_limits<float>::max(); // Only closer hits are accepted
+    float u = 0.0f, v = 0.0f; // Barycentric weights of v1 and v2 on triangles
+    uint32_t primId = NONE;   // Triangle within its mesh, or sphere within the sphere set
+    uint32_t objectId = NONE; // Top level object of the scene the primitive belongs to
+
+    bool hit() const { return primId != NONE; }
+};
+
+#endif // HITRESULT_H
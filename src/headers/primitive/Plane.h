@@ -14,36 +14,49 @@ public:
     Plane(const glm::vec3& point, const glm::vec3& normal)
         : point(point), normal(glm::normalize(normal)) {}
 
-    std::optional<HitResult> intersect(Ray& ray) {
+    // Lowers ray.tmax and writes hit (primId 0) on a hit in (ray.tmin, ray.tmax), like the other primitives
+    bool intersect(Ray& ray, HitRecord& hit) const {
         // Calculate the denominator of the intersection equation
         float denom = glm::dot(ray.direction, normal);
         
         // If the denominator is near zero, the ray is parallel to the plane
         if (std::abs(denom) < 1e-6f) {
-            return std::nullopt; // No intersection, ray is parallel
+            return false; // No intersection, ray is parallel
         }
         
         // Calculate the numerator (distance from ray origin to a point on the plane)
         float t = glm::dot(point - ray.origin, normal) / denom;
         
-        // If t is negative, the intersection point is behind the ray's origin
-        if (t < 0) {
-            return std::nullopt; // No intersection in front of the ray
+        // Behind the origin or beyond something already hit
+        if (!ray.inRange(t)) {
+            return false;
         }
 
-        // Calculate the intersection point
-        glm::vec3 intersectionPoint = ray.origin + t * ray.direction;
-        
-        // Return the hit result
+        ray.tmax = t;
+        hit.t = t;
+        hit.primId = 0;
+        return true;
+    }
+
+    // Full hit for a record the plane won
+    HitResult shade(const Ray& ray, float t) const {
         HitResult hitResult;
         hitResult.t = t;
-        hitResult.point = intersectionPoint;
+        hitResult.point = ray.at(t);
         hitResult.normal = normal;
         hitResult.uv = glm::vec2(0); // No UV coordinates for a plane?
         hitResult.color = glm::vec3(1);
-        
         return hitResult;
     }
+
+    // Any hit in (ray.tmin, ray.tmax)
+    bool occludes(const Ray& ray) const {
+        float denom = glm::dot(ray.direction, normal);
+        if (std::abs(denom) < 1e-6f) return false;
+
+        float t = glm::dot(point - ray.origin, normal) / denom;
+        return ray.inRange(t);
+    }
 };
 
 #endif // PLANE_H
\ No newline at end of file
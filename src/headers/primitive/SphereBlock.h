@@ -0,0 +1,196 @@
+#ifndef SPHEREBLOCK_H
+#define SPHEREBLOCK_H
+
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "Circle.h"
+#include "../Ray.h"
+
+static constexpr uint32_t SPHERE_BLOCK_EMPTY = 0xFFFFFFFF;
+
+// Up to N spheres of one BVH leaf, centers and squared radii in separate arrays so a ray is tested
+// against all of them in one SIMD step. Unused lanes have a negative squared radius and never hit.
+template<int N>
+struct alignas(32) SphereBlock
+{
+    float cx[N], cy[N], cz[N];
+    float radius2[N];
+    uint32_t primId[N]; // Sphere index in the set, SPHERE_BLOCK_EMPTY for unused lanes
+
+    void clear()
+    {
+        for (int i = 0; i < N; i++) {
+            cx[i] = cy[i] = cz[i] = 0.0f;
+            radius2[i] = -1.0f;
+            primId[i] = SPHERE_BLOCK_EMPTY;
+        }
+    }
+
+    void set(int lane, const Circle& sphere, uint32_t sphereIdx)
+    {
+        cx[lane] = sphere.getPosition().x; cy[lane] = sphere.getPosition().y; cz[lane] = sphere.getPosition().z;
+        radius2[lane] = sphere.getRadius() * sphere.getRadius();
+        primId[lane] = sphereIdx;
+    }
+};
+
+// What every sphere test of one ray shares: a = dot(direction, direction) of the quadratic and its inverse
+struct SphereRay
+{
+    float a, invA;
+
+    static SphereRay fromRay(const Ray& ray)
+    {
+        float a = glm::dot(ray.direction, ray.direction);
+        return {a, 1.0f / a};
+    }
+};
+
+// Ray against every sphere of a block, each lane takes its first intersection past ray.tmin like Circle::intersect,
+// which also explains the discriminant. Returns the lane of the nearest hit in (ray.tmin, closestT) and writes
+// its distance, or returns -1. Specialized for SSE and AVX below.
+template<int N>
+struct SphereBlockTest
+{
+    static int intersect(const SphereBlock<N>& block, const Ray& ray, const SphereRay& sphereRay, float closestT, float& t)
+    {
+        int nearest = -1;
+        for (int i = 0; i < N; i++) {
+            glm::vec3 oc = ray.origin - glm::vec3(block.cx[i], block.cy[i], block.cz[i]);
+            float b = glm::dot(oc, ray.direction);
+            glm::vec3 l = oc - (b * sphereRay.invA) * ray.direction;
+            float discriminant = sphereRay.a * (block.radius2[i] - glm::dot(l, l));
+            if (discriminant <= 0.0f) continue;
+
+            float root = std::sqrt(discriminant);
+            float laneT = (-b - root) * sphereRay.invA;
+            if (laneT <= ray.tmin) laneT = (-b + root) * sphereRay.invA;
+            if (laneT > ray.tmin && laneT < closestT) {
+                closestT = t = laneT;
+                nearest = i;
+            }
+        }
+        return nearest;
+    }
+};
+
+#if defined(__SSE__) || defined(_M_X64)
+// Four lanes of a block starting at first, which keeps the loads 16 byte aligned for first = 0 or 4
+template<int N>
+int intersectSphereBlockSSE(const SphereBlock<N>& block, int first, const Ray& ray, const SphereRay& sphereRay, float closestT, float& tOut)
+{
+    __m128 ocx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(block.cx + first));
+    __m128 ocy = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(block.cy + first));
+    __m128 ocz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(block.cz + first));
+
+    const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+    __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+
+    // l = oc - b / a * direction, the point on the ray closest to the center
+    __m128 k = _mm_mul_ps(b, _mm_set1_ps(sphereRay.invA));
+    __m128 lx = _mm_sub_ps(ocx, _mm_mul_ps(k, dx)), ly = _mm_sub_ps(ocy, _mm_mul_ps(k, dy)), lz = _mm_sub_ps(ocz, _mm_mul_ps(k, dz));
+    __m128 l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz));
+    __m128 discriminant = _mm_mul_ps(_mm_set1_ps(sphereRay.a), _mm_sub_ps(_mm_load_ps(block.radius2 + first), l2));
+    __m128 valid = _mm_cmpgt_ps(discriminant, _mm_setzero_ps());
+    if (_mm_movemask_ps(valid) == 0) return -1;
+
+    // Lanes that miss take the root of a negative number, valid keeps their NaN out.
+    // The far root replaces the near one where that is at or before tmin.
+    const __m128 root = _mm_sqrt_ps(discriminant), invA = _mm_set1_ps(sphereRay.invA), tmin = _mm_set1_ps(ray.tmin);
+    __m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(b, root)), invA);
+    __m128 tFar = _mm_mul_ps(_mm_sub_ps(root, b), invA);
+    __m128 useFar = _mm_cmple_ps(tNear, tmin);
+    __m128 t = _mm_or_ps(_mm_and_ps(useFar, tFar), _mm_andnot_ps(useFar, tNear));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, tmin), _mm_cmplt_ps(t, _mm_set1_ps(closestT))));
+    if (_mm_movemask_ps(valid) == 0) return -1;
+
+    // Horizontal min over the valid lanes, misses count as closestT
+    __m128 tValid = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, _mm_set1_ps(closestT)));
+    __m128 tMin = _mm_min_ps(tValid, _mm_shuffle_ps(tValid, tValid, _MM_SHUFFLE(2, 3, 0, 1)));
+    tMin = _mm_min_ps(tMin, _mm_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+    int mask = _mm_movemask_ps(_mm_and_ps(valid, _mm_cmpeq_ps(tValid, tMin)));
+    int lane = 0;
+    while (!(mask & (1 << lane))) lane++;
+
+    tOut = _mm_cvtss_f32(tMin);
+    return first + lane;
+}
+
+template<>
+struct SphereBlockTest<4>
+{
+    static int intersect(const SphereBlock<4>& block, const Ray& ray, const SphereRay& sphereRay, float closestT, float& t)
+    {
+        return intersectSphereBlockSSE(block, 0, ray, sphereRay, closestT, t);
+    }
+};
+#endif
+
+#if defined(__AVX__)
+template<>
+struct SphereBlockTest<8>
+{
+    static int intersect(const SphereBlock<8>& block, const Ray& ray, const SphereRay& sphereRay, float closestT, float& tOut)
+    {
+        __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(block.cx));
+        __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(block.cy));
+        __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(block.cz));
+
+        const __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+
+        // l = oc - b / a * direction, the point on the ray closest to the center
+        __m256 k = _mm256_mul_ps(b, _mm256_set1_ps(sphereRay.invA));
+        __m256 lx = _mm256_sub_ps(ocx, _mm256_mul_ps(k, dx));
+        __m256 ly = _mm256_sub_ps(ocy, _mm256_mul_ps(k, dy));
+        __m256 lz = _mm256_sub_ps(ocz, _mm256_mul_ps(k, dz));
+        __m256 l2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz));
+        __m256 discriminant = _mm256_mul_ps(_mm256_set1_ps(sphereRay.a), _mm256_sub_ps(_mm256_load_ps(block.radius2), l2));
+        __m256 valid = _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GT_OQ);
+        if (_mm256_movemask_ps(valid) == 0) return -1;
+
+        // Lanes that miss take the root of a negative number, valid keeps their NaN out.
+        // The far root replaces the near one where that is at or before tmin.
+        const __m256 root = _mm256_sqrt_ps(discriminant), invA = _mm256_set1_ps(sphereRay.invA), tmin = _mm256_set1_ps(ray.tmin);
+        __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_add_ps(b, root)), invA);
+        __m256 tFar = _mm256_mul_ps(_mm256_sub_ps(root, b), invA);
+        __m256 t = _mm256_blendv_ps(tNear, tFar, _mm256_cmp_ps(tNear, tmin, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, tmin, _CMP_GT_OQ),
+                                                   _mm256_cmp_ps(t, _mm256_set1_ps(closestT), _CMP_LT_OQ)));
+        if (_mm256_movemask_ps(valid) == 0) return -1;
+
+        // Horizontal min over the valid lanes, misses count as closestT
+        __m256 tValid = _mm256_blendv_ps(_mm256_set1_ps(closestT), t, valid);
+        __m256 tMin = _mm256_min_ps(tValid, _mm256_permute2f128_ps(tValid, tValid, 1));
+        tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(2, 3, 0, 1)));
+        tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+        int mask = _mm256_movemask_ps(_mm256_and_ps(valid, _mm256_cmp_ps(tValid, tMin, _CMP_EQ_OQ)));
+        int lane = 0;
+        while (!(mask & (1 << lane))) lane++;
+
+        tOut = _mm256_cvtss_f32(tMin);
+        return lane;
+    }
+};
+#elif defined(__SSE__) || defined(_M_X64)
+// Without AVX a block of 8 is two SSE halves, the second only takes hits closer than the first
+template<>
+struct SphereBlockTest<8>
+{
+    static int intersect(const SphereBlock<8>& block, const Ray& ray, const SphereRay& sphereRay, float closestT, float& t)
+    {
+        int nearest = intersectSphereBlockSSE(block, 0, ray, sphereRay, closestT, t);
+        if (nearest >= 0) closestT = t;
+        int upper = intersectSphereBlockSSE(block, 4, ray, sphereRay, closestT, t);
+        return upper >= 0 ? upper : nearest;
+    }
+};
+#endif
+
+#endif // SPHEREBLOCK_H
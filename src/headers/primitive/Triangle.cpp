@@ -4,94 +4,53 @@
 #include "../Ray.h"
 #include <iostream>
 
-std::optional<HitResult> Triangle::intersect(const Ray& ray, const std::vector<Texture>& textures) {
-    HitResult closestHit;
-    closestHit.t = std::numeric_limits<float>::max();
-
-    glm::vec3 e1 = v1 - v0; // Edge 1
-    glm::vec3 e2 = v2 - v0; // Edge 2
-    glm::vec3 h = glm::cross(ray.direction, e2);
-    float a = glm::dot(e1, h);
-
-    //parallel
-    if (std::abs(a) < 1e-8f) return std::nullopt;
-
-    float f = 1.0f / a;
-    glm::vec3 s = ray.origin - v0;
-    float u = f * glm::dot(s, h);
-
-    if (u < 0.0f || u > 1.0f) return std::nullopt;
-
-    glm::vec3 q = glm::cross(s, e1);
-    float v = f * glm::dot(ray.direction, q);
-    if (v < 0.0f || u + v > 1.0f) return std::nullopt;
-
-    float t = f * glm::dot(e2, q);
-    if (t > 1e-8f && t < closestHit.t) {
-        closestHit.t = t;
-        closestHit.point = ray.origin + t * ray.direction;
-        closestHit.normal = glm::normalize(normal);
-
-        // Barycentric interpolation for UV coordinates
-        float w = 1.0f - u - v;
-        glm::vec2 uv = w * uv0 + u * uv1 + v * uv2;
-
-        // Sample the texture if it exists
-        if (textureIndex >= 0) {
-            // Fetch the texture based on the index
-            const Texture& texture = textures[textureIndex];
-            glm::vec3 textureColor = texture.sample(uv.x, uv.y);
-            closestHit.color = textureColor; // Store the texture color
-        }else{
-            closestHit.color = normal;
-        }
-
-        return closestHit;
+TriangleAffine TriangleAffine::fromVertices(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) {
+    glm::vec3 e1 = v1 - v0;
+    glm::vec3 e2 = v2 - v0;
+    glm::vec3 n = glm::cross(e1, e2);
+    glm::vec3 c1 = glm::cross(v1, v0);
+    glm::vec3 c2 = glm::cross(v2, v0);
+    float planeDist = -glm::dot(v0, n);
+
+    // Divide by the largest normal component, the row for that axis then has a fixed 1 in it.
+    // Row 2 is divided by its magnitude only, so its sign still tells the front face from the back.
+    TriangleAffine affine;
+    glm::vec3 absN = glm::abs(n);
+    if (absN.x > absN.y && absN.x > absN.z) {
+        affine.row0 = glm::vec4(0.0f, e2.z, -e2.y, c2.x) / n.x;
+        affine.row1 = glm::vec4(0.0f, -e1.z, e1.y, -c1.x) / n.x;
+        affine.row2 = glm::vec4(n.x, n.y, n.z, planeDist) / absN.x;
+    } else if (absN.y > absN.z) {
+        affine.row0 = glm::vec4(-e2.z, 0.0f, e2.x, c2.y) / n.y;
+        affine.row1 = glm::vec4(e1.z, 0.0f, -e1.x, -c1.y) / n.y;
+        affine.row2 = glm::vec4(n.x, n.y, n.z, planeDist) / absN.y;
+    } else if (absN.z > 0.0f) {
+        affine.row0 = glm::vec4(e2.y, -e2.x, 0.0f, c2.z) / n.z;
+        affine.row1 = glm::vec4(-e1.y, e1.x, 0.0f, -c1.z) / n.z;
+        affine.row2 = glm::vec4(n.x, n.y, n.z, planeDist) / absN.z;
+    } else {
+        // Degenerate, a zero transform never gives a valid distance
+        affine.row0 = affine.row1 = affine.row2 = glm::vec4(0.0f);
     }
-
-    return std::nullopt;
+    return affine;
 }
 
-std::optional<HitResult> Triangle::intersectFast(const Ray& ray, const std::vector<Texture>& textures) {
-    HitResult closestHit;
-    closestHit.t = std::numeric_limits<float>::max();
-
-    // Compute determinant (a)
-    glm::vec3 h = glm::cross(ray.direction, edge2);
-    float a = glm::dot(edge1, h);
-
-    if (std::abs(a) < 1e-8f) return std::nullopt; // Parallel
-    //if (a > 0.0f) return std::nullopt;
-
-    float f = 1.0f / a;
-    glm::vec3 s = ray.origin - v0;
-    float u = f * glm::dot(s, h);
-    if (u < 0.0f || u > 1.0f) return std::nullopt;
-
-    glm::vec3 q = glm::cross(s, edge1);
-    float v = f * glm::dot(ray.direction, q);
-    if (v < 0.0f || u + v > 1.0f) return std::nullopt;
+HitResult Triangle::shade(const Ray& ray, const HitRecord& hit, const std::vector<Texture>& textures) const {
+    HitResult result;
+    result.t = hit.t;
+    result.point = ray.origin + hit.t * ray.direction;
+    result.normal = glm::normalize(normal);
 
     // Barycentric interpolation for UV coordinates
-    float w = 1.0f - u - v;
-    glm::vec2 uv = w * uv0 + u * uv1 + v * uv2;
-
-    float t = f * glm::dot(edge2, q);
-    if (t > 1e-8f && t < closestHit.t) {
-        closestHit.t = t;
-        closestHit.point = ray.origin + t * ray.direction;
-        closestHit.normal = glm::normalize(normal);
-        // Sample the texture if it exists
-        if (textureIndex >= 0) {
-            // Fetch the texture based on the index
-            const Texture& texture = textures[textureIndex];
-            glm::vec3 textureColor = texture.sample(uv.y, uv.x);
-            closestHit.color = textureColor; // Store the texture color
-        }else{
-            closestHit.color = normal;
-        }
-        return closestHit;
+    float w = 1.0f - hit.u - hit.v;
+    result.uv = w * uv0 + hit.u * uv1 + hit.v * uv2;
+
+    // Sample the texture if it exists
+    if (textureIndex >= 0) {
+        result.color = textures[textureIndex].sample(result.uv.x, result.uv.y);
+    } else {
+        result.color = normal;
     }
+    return result;
+}
 
-    return std::nullopt;
-}
\ No newline at end of file
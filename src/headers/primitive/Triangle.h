@@ -1,12 +1,16 @@
 #ifndef TRIANGLE_H
 #define TRIANGLE_H
 
+#include <cmath>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <optional>
+#include <vector>
+
+#include "../Ray.h"
+#include "HitResult.h"
 
-class Ray;
 class Texture;
-struct HitResult;
 
 class Triangle 
 {
@@ -16,13 +20,105 @@ class Triangle
     glm::vec2 uv0, uv1, uv2; // UV coordinates
     int textureIndex;
 
-    glm::vec3 edge1, edge2; // Precomputed edges (For intrersectFast)
+    glm::vec3 edge1, edge2; // Precomputed edges
 
     Triangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& normal, const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2, int textureIndex)
         : v0(v0), v1(v1), v2(v2), edge1(v1 - v0), edge2(v2 - v0), normal(normal), uv0(uv0), uv1(uv1), uv2(uv2), textureIndex(textureIndex) {}
 
-    std::optional<HitResult> intersect(const Ray& ray, const std::vector<Texture>& textures);
-    std::optional<HitResult> intersectFast(const Ray& ray, const std::vector<Texture>& textures);
+    // Call after moving the vertices so intersect sees the new shape
+    void updateEdges() { edge1 = v1 - v0; edge2 = v2 - v0; }
+
+    // On a hit in (ray.tmin, ray.tmax) lower ray.tmax to it and write it to hit (as primId), without shading it.
+    // Flags are RayFlags, RAY_ALPHA_TEST is left to the mesh since the triangle does not own its textures.
+    template<unsigned Flags = RAY_CLOSEST_HIT>
+    bool intersect(Ray& ray, uint32_t primId, HitRecord& hit) const;
+
+    // Full hit for a record this triangle won. Reads the normal, UVs and texture, so only call it for the closest hit.
+    HitResult shade(const Ray& ray, const HitRecord& hit, const std::vector<Texture>& textures) const;
+};
+
+// The part of a triangle the intersection test reads, 36 bytes. Meshes keep these in their own array
+// so traversal reads neither the index buffer nor the shared vertices, normals and UVs.
+struct TriangleHot
+{
+    glm::vec3 v0;
+    glm::vec3 edge1, edge2;
+
+    static TriangleHot fromVertices(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) { return {v0, v1 - v0, v2 - v0}; }
+
+    // Möller-Trumbore, true for a hit in (ray.tmin, closestT) with its distance and barycentrics.
+    // closestT is separate from ray.tmax for the tile and block tests, which keep one per ray elsewhere.
+    // With RAY_CULL_BACKFACES only triangles wound counter-clockwise as seen from the ray are hit.
+    template<unsigned Flags = RAY_CLOSEST_HIT>
+    bool intersect(const Ray& ray, float closestT, float& t, float& u, float& v) const
+    {
+        glm::vec3 h = glm::cross(ray.direction, edge2);
+        float a = glm::dot(edge1, h);
+        if constexpr ((Flags & RAY_CULL_BACKFACES) != 0) {
+            if (a < 1e-8f) return false; // Back facing or parallel
+        } else {
+            if (std::abs(a) < 1e-8f) return false; // Parallel
+        }
+
+        float f = 1.0f / a;
+        glm::vec3 s = ray.origin - v0;
+        u = f * glm::dot(s, h);
+        if (u < 0.0f || u > 1.0f) return false;
+
+        glm::vec3 q = glm::cross(s, edge1);
+        v = f * glm::dot(ray.direction, q);
+        if (v < 0.0f || u + v > 1.0f) return false;
+
+        t = f * glm::dot(edge2, q);
+        return t > ray.tmin && t < closestT;
+    }
 };
 
+// Which per-triangle test a mesh runs, see TriangleMesh::setTriangleTest
+enum class TriangleTest { MollerTrumbore, BaldwinWeber };
+
+// Baldwin-Weber: the triangle stored as the affine transform from world space into its own barycentric space,
+// rows 0 and 1 give the barycentrics and row 2 the distance to the plane along the largest normal axis.
+// 48 bytes instead of 36 but no cross products per ray, meant for static geometry.
+struct TriangleAffine
+{
+    glm::vec4 row0, row1, row2;
+
+    static TriangleAffine fromVertices(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
+
+    // Same contract as TriangleHot::intersect, u and v are the barycentrics of v1 and v2
+    template<unsigned Flags = RAY_CLOSEST_HIT>
+    bool intersect(const Ray& ray, float closestT, float& t, float& u, float& v) const
+    {
+        float originDist = glm::dot(glm::vec3(row2), ray.origin) + row2.w;
+        float directionDist = glm::dot(glm::vec3(row2), ray.direction);
+        if constexpr ((Flags & RAY_CULL_BACKFACES) != 0) {
+            if (!(directionDist < 0.0f)) return false; // Row 2 keeps the sign of the face normal
+        }
+        t = -originDist / directionDist;
+        if (!(t > ray.tmin && t < closestT)) return false; // Also rejects parallel rays and degenerate triangles
+
+        glm::vec3 p = ray.origin + t * ray.direction;
+        u = glm::dot(glm::vec3(row0), p) + row0.w;
+        v = glm::dot(glm::vec3(row1), p) + row1.w;
+        return u >= 0.0f && v >= 0.0f && u + v <= 1.0f;
+    }
+};
+
+template<unsigned Flags>
+bool Triangle::intersect(Ray& ray, uint32_t primId, HitRecord& hit) const
+{
+    float t, u, v;
+    if (!TriangleHot{v0, edge1, edge2}.intersect<Flags>(ray, ray.tmax, t, u, v)) return false;
+
+    ray.tmax = t;
+    hit.t = t;
+    if constexpr ((Flags & RAY_NO_UVS) == 0) {
+        hit.u = u;
+        hit.v = v;
+    }
+    hit.primId = primId;
+    return true;
+}
+
 #endif // TRIANGLE_H
\ No newline at end of file
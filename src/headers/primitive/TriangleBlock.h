@@ -0,0 +1,205 @@
+#ifndef TRIANGLEBLOCK_H
+#define TRIANGLEBLOCK_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "Triangle.h"
+#include "../Ray.h"
+
+static constexpr uint32_t TRIANGLE_BLOCK_EMPTY = 0xFFFFFFFF;
+
+// Up to N triangles of one BVH leaf with every component in its own array, so a ray is tested
+// against all of them by one SIMD Moller-Trumbore. Unused lanes have zero edges and never hit.
+template<int N>
+struct alignas(32) TriangleBlock
+{
+    float v0x[N], v0y[N], v0z[N];
+    float e1x[N], e1y[N], e1z[N];
+    float e2x[N], e2y[N], e2z[N];
+    uint32_t primId[N]; // Triangle index in the mesh, TRIANGLE_BLOCK_EMPTY for unused lanes
+
+    void clear()
+    {
+        for (int i = 0; i < N; i++) {
+            v0x[i] = v0y[i] = v0z[i] = 0.0f;
+            e1x[i] = e1y[i] = e1z[i] = 0.0f;
+            e2x[i] = e2y[i] = e2z[i] = 0.0f;
+            primId[i] = TRIANGLE_BLOCK_EMPTY;
+        }
+    }
+
+    void set(int lane, const TriangleHot& triangle, uint32_t triIdx)
+    {
+        v0x[lane] = triangle.v0.x; v0y[lane] = triangle.v0.y; v0z[lane] = triangle.v0.z;
+        e1x[lane] = triangle.edge1.x; e1y[lane] = triangle.edge1.y; e1z[lane] = triangle.edge1.z;
+        e2x[lane] = triangle.edge2.x; e2y[lane] = triangle.edge2.y; e2z[lane] = triangle.edge2.z;
+        primId[lane] = triIdx;
+    }
+};
+
+// Ray against every triangle of a block. Returns the lane of the nearest hit in (ray.tmin, closestT) and
+// writes its distance and barycentrics, or returns -1. Specialized for SSE and AVX below.
+template<int N>
+struct TriangleBlockTest
+{
+    static int intersect(const TriangleBlock<N>& block, const Ray& ray, float closestT, float& t, float& u, float& v)
+    {
+        int nearest = -1;
+        for (int i = 0; i < N; i++) {
+            TriangleHot triangle{{block.v0x[i], block.v0y[i], block.v0z[i]},
+                                 {block.e1x[i], block.e1y[i], block.e1z[i]},
+                                 {block.e2x[i], block.e2y[i], block.e2z[i]}};
+            float laneT, laneU, laneV;
+            if (triangle.intersect(ray, closestT, laneT, laneU, laneV)) {
+                closestT = t = laneT;
+                u = laneU;
+                v = laneV;
+                nearest = i;
+            }
+        }
+        return nearest;
+    }
+};
+
+#if defined(__SSE__) || defined(_M_X64)
+// Four lanes of a block starting at first, which keeps the loads 16 byte aligned for first = 0 or 4
+template<int N>
+int intersectBlockSSE(const TriangleBlock<N>& block, int first, const Ray& ray, float closestT, float& tOut, float& uOut, float& vOut)
+{
+    const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+    const __m128 e1x = _mm_load_ps(block.e1x + first), e1y = _mm_load_ps(block.e1y + first), e1z = _mm_load_ps(block.e1z + first);
+    const __m128 e2x = _mm_load_ps(block.e2x + first), e2y = _mm_load_ps(block.e2y + first), e2z = _mm_load_ps(block.e2z + first);
+
+    // h = cross(direction, edge2), a = dot(edge1, h)
+    __m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+    __m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+    __m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+    __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+    __m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+
+    __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(block.v0x + first));
+    __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(block.v0y + first));
+    __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(block.v0z + first));
+    __m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+
+    // q = cross(s, edge1)
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+    __m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+    __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    __m128 absA = _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+    __m128 valid = _mm_cmpge_ps(absA, _mm_set1_ps(1e-8f));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(ray.tmin)), _mm_cmplt_ps(t, _mm_set1_ps(closestT))));
+    if (_mm_movemask_ps(valid) == 0) return -1;
+
+    // Horizontal min over the valid lanes, misses count as closestT
+    __m128 tValid = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, _mm_set1_ps(closestT)));
+    __m128 tMin = _mm_min_ps(tValid, _mm_shuffle_ps(tValid, tValid, _MM_SHUFFLE(2, 3, 0, 1)));
+    tMin = _mm_min_ps(tMin, _mm_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+    int mask = _mm_movemask_ps(_mm_and_ps(valid, _mm_cmpeq_ps(tValid, tMin)));
+    int lane = 0;
+    while (!(mask & (1 << lane))) lane++;
+
+    alignas(16) float ts[4], us[4], vs[4];
+    _mm_store_ps(ts, t);
+    _mm_store_ps(us, u);
+    _mm_store_ps(vs, v);
+    tOut = ts[lane];
+    uOut = us[lane];
+    vOut = vs[lane];
+    return first + lane;
+}
+
+template<>
+struct TriangleBlockTest<4>
+{
+    static int intersect(const TriangleBlock<4>& block, const Ray& ray, float closestT, float& t, float& u, float& v)
+    {
+        return intersectBlockSSE(block, 0, ray, closestT, t, u, v);
+    }
+};
+#endif
+
+#if defined(__AVX__)
+template<>
+struct TriangleBlockTest<8>
+{
+    static int intersect(const TriangleBlock<8>& block, const Ray& ray, float closestT, float& tOut, float& uOut, float& vOut)
+    {
+        const __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+        const __m256 e1x = _mm256_load_ps(block.e1x), e1y = _mm256_load_ps(block.e1y), e1z = _mm256_load_ps(block.e1z);
+        const __m256 e2x = _mm256_load_ps(block.e2x), e2y = _mm256_load_ps(block.e2y), e2z = _mm256_load_ps(block.e2z);
+
+        // h = cross(direction, edge2), a = dot(edge1, h)
+        __m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+        __m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+        __m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+        __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+        __m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+
+        __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(block.v0x));
+        __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(block.v0y));
+        __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(block.v0z));
+        __m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+
+        // q = cross(s, edge1)
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(e1y, sz));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(e1z, sx));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(e1x, sy));
+        __m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+        __m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+
+        const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+        __m256 absA = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+        __m256 valid = _mm256_cmp_ps(absA, _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+        valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+        valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+        valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(ray.tmin), _CMP_GT_OQ),
+                                                   _mm256_cmp_ps(t, _mm256_set1_ps(closestT), _CMP_LT_OQ)));
+        if (_mm256_movemask_ps(valid) == 0) return -1;
+
+        // Horizontal min over the valid lanes, misses count as closestT
+        __m256 tValid = _mm256_blendv_ps(_mm256_set1_ps(closestT), t, valid);
+        __m256 tMin = _mm256_min_ps(tValid, _mm256_permute2f128_ps(tValid, tValid, 1));
+        tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(2, 3, 0, 1)));
+        tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+        int mask = _mm256_movemask_ps(_mm256_and_ps(valid, _mm256_cmp_ps(tValid, tMin, _CMP_EQ_OQ)));
+        int lane = 0;
+        while (!(mask & (1 << lane))) lane++;
+
+        alignas(32) float ts[8], us[8], vs[8];
+        _mm256_store_ps(ts, t);
+        _mm256_store_ps(us, u);
+        _mm256_store_ps(vs, v);
+        tOut = ts[lane];
+        uOut = us[lane];
+        vOut = vs[lane];
+        return lane;
+    }
+};
+#elif defined(__SSE__) || defined(_M_X64)
+// Without AVX a block of 8 is two SSE halves, the second only takes hits closer than the first
+template<>
+struct TriangleBlockTest<8>
+{
+    static int intersect(const TriangleBlock<8>& block, const Ray& ray, float closestT, float& t, float& u, float& v)
+    {
+        int nearest = intersectBlockSSE(block, 0, ray, closestT, t, u, v);
+        if (nearest >= 0) closestT = t;
+        int upper = intersectBlockSSE(block, 4, ray, closestT, t, u, v);
+        return upper >= 0 ? upper : nearest;
+    }
+};
+#endif
+
+#endif // TRIANGLEBLOCK_H
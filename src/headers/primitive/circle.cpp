@@ -7,21 +7,41 @@
 Circle::Circle(const glm::vec3& position, float radius)
     : position(position), radius(radius) {}
 
-std::optional<HitResult> Circle::intersect(Ray& ray) {
+bool Circle::intersect(Ray& ray, HitRecord& hit) const {
+    float t;
+    if (!firstRoot(ray, t)) return false;
+
+    ray.tmax = t;
+    hit.t = t;
+    hit.primId = 0;
+    return true;
+}
+
+// First intersection in (ray.tmin, ray.tmax), the same math SphereBlockTest uses. b is half of the usual b, and the
+// discriminant b^2 - ac is taken as a * (r^2 - |oc - b/a * d|^2), which does not cancel out for small spheres far away.
+// The far root counts when the near one is at or before tmin, for rays starting inside or with a raised tmin.
+bool Circle::firstRoot(const Ray& ray, float& t) const {
     glm::vec3 oc = ray.origin - position;
     float a = glm::dot(ray.direction, ray.direction);
-    float b = 2.0f * glm::dot(oc, ray.direction);
-    float c = glm::dot(oc, oc) - radius * radius;
-    float discriminant = b * b - 4 * a * c;
-
-    if (discriminant > 0) {
-        float t = (-b - sqrt(discriminant)) / (2.0f * a);
-        if (t > 0) {
-            glm::vec3 hitPoint = ray.at(t);
-            glm::vec3 normal = glm::normalize(hitPoint - position);
-            return HitResult{t, hitPoint, normal};
-        }
-    }
-
-    return std::nullopt;
+    float invA = 1.0f / a;
+    float b = glm::dot(oc, ray.direction);
+    glm::vec3 l = oc - (b * invA) * ray.direction;
+    float discriminant = a * (radius * radius - glm::dot(l, l));
+    if (discriminant <= 0) return false;
+
+    float root = std::sqrt(discriminant);
+    t = (-b - root) * invA;
+    if (t <= ray.tmin) t = (-b + root) * invA;
+    return ray.inRange(t);
+}
+
+HitResult Circle::shade(const Ray& ray, float t) const {
+    glm::vec3 hitPoint = ray.at(t);
+    glm::vec3 normal = glm::normalize(hitPoint - position);
+    return HitResult{t, hitPoint, normal, glm::vec2(0), normal}; // Shaded by its normal
+}
+
+bool Circle::occludes(const Ray& ray) const {
+    float t;
+    return firstRoot(ray, t);
 }
@@ -2,9 +2,9 @@
 #define CIRCLE_H
 
 #include "glm/ext/vector_float3.hpp"
-#include <optional>
 
 struct HitResult;
+struct HitRecord;
 class Ray;
 
 class Circle
@@ -12,11 +12,18 @@ class Circle
 public:
     Circle() : position(glm::vec3(0)), radius(0.125f) {};
     Circle(const glm::vec3& position, float radius);
-    std::optional<HitResult> intersect(Ray& ray);
+    bool intersect(Ray& ray, HitRecord& hit) const; // Lowers ray.tmax and writes hit (primId 0) on a hit in range, no shading
+    HitResult shade(const Ray& ray, float t) const;
+    bool occludes(const Ray& ray) const; // Any hit in (ray.tmin, ray.tmax)
+
+    const glm::vec3& getPosition() const { return position; }
+    float getRadius() const { return radius; }
 
 private:
     glm::vec3 position;
     float radius;
+
+    bool firstRoot(const Ray& ray, float& t) const;
 };
 
 #endif // CIRCLE_H
\ No newline at end of file
@@ -1,17 +1,33 @@
 #include "headers/AssetManager.h"
-#include "headers/TriangleMesh.h"
+#include "headers/BVHCache.h"
+#include "headers/Scene.h"
+#include "headers/Benchmark.h"
 #include "headers/GraphicsCPU.h"
 
 #include <cstdlib>
 #include <iostream>
+#include <string>
 
-int main()
+int main(int argc, char* argv[])
 {
     //Singelton
     AssetManager& assetManager = AssetManager::getInstance();
 
-    TriangleMesh scene;
-    scene.loadGLTF(assetManager.loadModel("assets/Cube/Cube.gltf"));
+    // --benchmark [model.gltf] compares the BVH layouts without opening a window
+    bool benchmark = argc > 1 && std::string(argv[1]) == "--benchmark";
+    std::string modelPath = benchmark && argc > 2 ? argv[2] : "assets/Cube/Cube.gltf";
+
+    //Meshes become shared bottom level structures, nodes become instances of them.
+    //Their triangles and BVHs are cached next to the model until it changes.
+    tinygltf::Model model = assetManager.loadModel(modelPath);
+    BVHCache cache(modelPath + ".bvhcache", BVHCache::hashModel(modelPath, model));
+    Scene scene;
+    scene.loadGLTF(model, &cache);
+
+    if (benchmark) {
+        Benchmark(800, 600).run(scene);
+        return 0;
+    }
 
     GraphicsCPU graphics;
     bool result = graphics.initialize(800, 600, "Ray Tracer");
@@ -19,8 +35,8 @@ int main()
         return -1;
     }
 
-    //Load the mesh into the graphics system
-    graphics.addMesh(scene);
+    //Load the scene into the graphics system
+    graphics.setScene(scene);
 
     graphics.renderLoop();
     graphics.shutdown();
@@ -0,0 +1,214 @@
+#include "../headers/BVHCache.h"
+#include "../headers/MappedFile.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<MeshPart>::value, "Mesh parts are cached as raw bytes");
+static_assert(std::is_trivially_copyable<BVHNode>::value, "BVH nodes are cached as raw bytes");
+
+namespace
+{
+    const char CACHE_MAGIC[8] = {'C', 'N', 'S', 'T', 'B', 'V', 'H', '\0'};
+
+    // Every section starts on this boundary so the arrays stay aligned inside the mapping
+    constexpr size_t SECTION_ALIGNMENT = 16;
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t meshCount;
+        uint64_t contentHash;
+        uint32_t partSize; // Catches layout changes that forgot the version bump
+        uint32_t nodeSize;
+    };
+
+    struct MeshHeader
+    {
+        uint64_t vertexCount;
+        uint64_t indexCount;
+        uint64_t partCount;
+        uint64_t nodeCount;
+        uint64_t primIndexCount;
+        uint32_t mode;
+        uint32_t layout;
+        uint32_t compressed;
+        float splitBudget;
+        uint32_t clusterNodes;
+        uint32_t leafGroupSize;
+    };
+
+    size_t alignSection(size_t offset)
+    {
+        return (offset + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1);
+    }
+
+    // 64 bit FNV-1a over whole words, byte at a time only for the tail
+    uint64_t hashBytes(const void* data, size_t size, uint64_t hash)
+    {
+        const uint64_t prime = 0x100000001B3ull;
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+            hash = (hash ^ word) * prime;
+        }
+        for (; i < size; i++) {
+            hash = (hash ^ bytes[i]) * prime;
+        }
+        return hash;
+    }
+}
+
+uint64_t BVHCache::hashModel(const std::string& gltfPath, const tinygltf::Model& model)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    std::ifstream file(gltfPath, std::ios::binary);
+    std::vector<char> json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    hash = hashBytes(json.data(), json.size(), hash);
+
+    for (const auto& buffer : model.buffers) {
+        hash = hashBytes(buffer.data.data(), buffer.data.size(), hash);
+    }
+    return hash;
+}
+
+bool BVHCache::load(size_t meshCount, const std::shared_ptr<std::vector<Texture>>& textures,
+                    std::vector<std::shared_ptr<TriangleMesh>>& meshes) const
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    MappedFile file;
+    if (!file.open(filePath)) return false;
+
+    const unsigned char* data = file.data();
+    size_t offset = 0;
+
+    // Hands out the next section of count elements, nullptr if the file is too short
+    auto section = [&](size_t count, size_t elementSize) -> const unsigned char* {
+        offset = alignSection(offset);
+        if (count > (file.size() - std::min(offset, file.size())) / elementSize) return nullptr;
+        const unsigned char* start = data + offset;
+        offset += count * elementSize;
+        return start;
+    };
+
+    const auto* header = reinterpret_cast<const FileHeader*>(section(1, sizeof(FileHeader)));
+    if (header == nullptr || std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header->version != VERSION || header->contentHash != contentHash || header->meshCount != meshCount ||
+        header->partSize != sizeof(MeshPart) || header->nodeSize != sizeof(BVHNode)) {
+        std::cout << "BVH cache " << filePath << " is missing or out of date" << std::endl;
+        return false;
+    }
+
+    std::vector<std::shared_ptr<TriangleMesh>> cachedMeshes;
+    for (size_t m = 0; m < meshCount; m++) {
+        const auto* meshHeader = reinterpret_cast<const MeshHeader*>(section(1, sizeof(MeshHeader)));
+        if (meshHeader == nullptr) return false;
+
+        const auto* positions = reinterpret_cast<const glm::vec3*>(section(meshHeader->vertexCount, sizeof(glm::vec3)));
+        const auto* normals = reinterpret_cast<const glm::vec3*>(section(meshHeader->vertexCount, sizeof(glm::vec3)));
+        const auto* uvs = reinterpret_cast<const glm::vec2*>(section(meshHeader->vertexCount, sizeof(glm::vec2)));
+        const auto* indices = reinterpret_cast<const uint32_t*>(section(meshHeader->indexCount, sizeof(uint32_t)));
+        const auto* parts = reinterpret_cast<const MeshPart*>(section(meshHeader->partCount, sizeof(MeshPart)));
+        const auto* nodes = reinterpret_cast<const BVHNode*>(section(meshHeader->nodeCount, sizeof(BVHNode)));
+        const auto* primIndices = reinterpret_cast<const uint32_t*>(section(meshHeader->primIndexCount, sizeof(uint32_t)));
+        if (positions == nullptr || normals == nullptr || uvs == nullptr || indices == nullptr || parts == nullptr ||
+            nodes == nullptr || primIndices == nullptr) return false;
+
+        BVHBuildSettings settings;
+        settings.mode = static_cast<BVHBuildMode>(meshHeader->mode);
+        settings.layout = static_cast<BVHLayout>(meshHeader->layout);
+        settings.compressed = meshHeader->compressed != 0;
+        settings.splitBudget = meshHeader->splitBudget;
+        settings.clusterNodes = meshHeader->clusterNodes != 0;
+        settings.leafGroupSize = meshHeader->leafGroupSize;
+
+        auto mesh = std::make_shared<TriangleMesh>();
+        mesh->loadCached(positions, normals, uvs, meshHeader->vertexCount, indices, meshHeader->indexCount,
+                         parts, meshHeader->partCount, nodes, meshHeader->nodeCount,
+                         primIndices, meshHeader->primIndexCount, settings, textures);
+        cachedMeshes.push_back(mesh);
+    }
+
+    meshes.swap(cachedMeshes);
+
+    float loadMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    std::cout << "BVH cache " << filePath << " loaded in " << loadMs << " ms" << std::endl;
+    return true;
+}
+
+bool BVHCache::save(const std::vector<std::shared_ptr<TriangleMesh>>& meshes) const
+{
+    // Written next to the real file first, so a crash never leaves a half written cache behind
+    std::string tempPath = filePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file) return false;
+
+        size_t offset = 0;
+        auto writeSection = [&](const void* data, size_t size) {
+            static const char padding[SECTION_ALIGNMENT] = {};
+            size_t aligned = alignSection(offset);
+            file.write(padding, aligned - offset);
+            file.write(static_cast<const char*>(data), size);
+            offset = aligned + size;
+        };
+
+        FileHeader header;
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = VERSION;
+        header.meshCount = static_cast<uint32_t>(meshes.size());
+        header.contentHash = contentHash;
+        header.partSize = sizeof(MeshPart);
+        header.nodeSize = sizeof(BVHNode);
+        writeSection(&header, sizeof(header));
+
+        for (const auto& mesh : meshes) {
+            const std::vector<glm::vec3>& positions = mesh->getPositions();
+            const std::vector<uint32_t>& indices = mesh->getIndices();
+            const std::vector<MeshPart>& parts = mesh->getParts();
+            const BVH& bvh = mesh->getBVH();
+            const BVHBuildSettings& settings = mesh->getBVHSettings();
+
+            MeshHeader meshHeader;
+            meshHeader.vertexCount = positions.size();
+            meshHeader.indexCount = indices.size();
+            meshHeader.partCount = parts.size();
+            meshHeader.nodeCount = bvh.getNodes().size();
+            meshHeader.primIndexCount = bvh.getPrimIndices().size();
+            meshHeader.mode = static_cast<uint32_t>(settings.mode);
+            meshHeader.layout = static_cast<uint32_t>(settings.layout);
+            meshHeader.compressed = settings.compressed ? 1 : 0;
+            meshHeader.splitBudget = settings.splitBudget;
+            meshHeader.clusterNodes = settings.clusterNodes ? 1 : 0;
+            meshHeader.leafGroupSize = settings.leafGroupSize;
+
+            writeSection(&meshHeader, sizeof(meshHeader));
+            writeSection(positions.data(), positions.size() * sizeof(glm::vec3));
+            writeSection(mesh->getNormals().data(), mesh->getNormals().size() * sizeof(glm::vec3));
+            writeSection(mesh->getUVs().data(), mesh->getUVs().size() * sizeof(glm::vec2));
+            writeSection(indices.data(), indices.size() * sizeof(uint32_t));
+            writeSection(parts.data(), parts.size() * sizeof(MeshPart));
+            writeSection(bvh.getNodes().data(), bvh.getNodes().size() * sizeof(BVHNode));
+            writeSection(bvh.getPrimIndices().data(), bvh.getPrimIndices().size() * sizeof(uint32_t));
+        }
+
+        if (!file) return false;
+    }
+
+    // rename does not replace an existing file on Windows
+    std::remove(filePath.c_str());
+    if (std::rename(tempPath.c_str(), filePath.c_str()) != 0) return false;
+
+    std::cout << "BVH cache written to " << filePath << std::endl;
+    return true;
+}
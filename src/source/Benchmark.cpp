@@ -0,0 +1,296 @@
+#include "../headers/Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+
+namespace
+{
+    // Set associative cache with LRU replacement that only counts misses
+    class CacheModel
+    {
+    public:
+        CacheModel(size_t capacity, size_t lineSize, size_t ways)
+            : lineShift(0), ways(ways), sets(capacity / lineSize / ways), tags(sets * ways, UINT64_MAX)
+        {
+            while ((size_t(1) << lineShift) < lineSize) lineShift++;
+        }
+
+        void access(const void* address)
+        {
+            uint64_t line = reinterpret_cast<uintptr_t>(address) >> lineShift;
+            uint64_t* set = &tags[(line % sets) * ways];
+
+            // Ways are kept most recently used first
+            size_t hit = ways;
+            for (size_t i = 0; i < ways; i++) {
+                if (set[i] == line) {
+                    hit = i;
+                    break;
+                }
+            }
+            if (hit == ways) {
+                misses++;
+                hit = ways - 1;
+            }
+            for (size_t i = hit; i > 0; i--) {
+                set[i] = set[i - 1];
+            }
+            set[0] = line;
+        }
+
+        uint64_t misses = 0;
+
+    private:
+        int lineShift;
+        size_t ways;
+        size_t sets;
+        std::vector<uint64_t> tags;
+    };
+}
+
+std::vector<Benchmark::Result> Benchmark::run(Scene& scene)
+{
+    scene.update();
+    Camera cam = frameScene(scene);
+
+    struct Config
+    {
+        const char* name;
+        BVHBuildMode mode;
+        BVHLayout layout;
+        bool compressed;
+        bool clusterNodes = false;
+        TraceMode traceMode = TraceMode::PerRay;
+        uint32_t leafGroupSize = 1;
+        TriangleTest triangleTest = TriangleTest::MollerTrumbore;
+    };
+    const Config configs[] = {
+        {"binary", BVHBuildMode::SAH, BVHLayout::Binary, false},
+        {"binary compressed", BVHBuildMode::SAH, BVHLayout::Binary, true},
+        {"wide4", BVHBuildMode::SAH, BVHLayout::Wide4, false},
+        {"wide4 compressed", BVHBuildMode::SAH, BVHLayout::Wide4, true},
+        {"wide8", BVHBuildMode::SAH, BVHLayout::Wide8, false},
+        {"wide8 compressed", BVHBuildMode::SAH, BVHLayout::Wide8, true},
+        {"binary sbvh", BVHBuildMode::SBVH, BVHLayout::Binary, false},
+        {"wide8 sbvh", BVHBuildMode::SBVH, BVHLayout::Wide8, false},
+        {"binary clustered", BVHBuildMode::SAH, BVHLayout::Binary, false, true},
+        {"wide8 clustered", BVHBuildMode::SAH, BVHLayout::Wide8, false, true},
+        {"binary tiles", BVHBuildMode::SAH, BVHLayout::Binary, false, false, TraceMode::Tiles},
+        {"binary packets", BVHBuildMode::SAH, BVHLayout::Binary, false, false, TraceMode::Packets},
+        {"binary streams", BVHBuildMode::SAH, BVHLayout::Binary, false, false, TraceMode::Streams},
+        {"binary 4-tri leaves", BVHBuildMode::SAH, BVHLayout::Binary, false, false, TraceMode::PerRay, 4},
+        {"wide4 4-tri leaves", BVHBuildMode::SAH, BVHLayout::Wide4, false, false, TraceMode::PerRay, 4},
+        {"wide8 8-tri leaves", BVHBuildMode::SAH, BVHLayout::Wide8, false, false, TraceMode::PerRay, 8},
+        {"binary baldwin-weber", BVHBuildMode::SAH, BVHLayout::Binary, false, false, TraceMode::PerRay, 1, TriangleTest::BaldwinWeber},
+        {"wide8 baldwin-weber", BVHBuildMode::SAH, BVHLayout::Wide8, false, false, TraceMode::PerRay, 1, TriangleTest::BaldwinWeber},
+    };
+
+    std::vector<Result> results;
+    for (const Config& config : configs) {
+        BVHBuildSettings settings;
+        settings.mode = config.mode;
+        settings.layout = config.layout;
+        settings.compressed = config.compressed;
+        settings.clusterNodes = config.clusterNodes;
+        settings.leafGroupSize = config.leafGroupSize;
+        for (const auto& mesh : scene.getMeshes()) {
+            mesh->setTriangleTest(config.triangleTest);
+        }
+        results.push_back(measure(config.name, scene, settings, cam, config.traceMode));
+    }
+
+    std::cout << std::endl << "Benchmark " << width << "x" << height << ", " << scene.getMeshes().size()
+              << " meshes, " << scene.getInstanceCount() << " instances" << std::endl;
+    std::printf("%-20s %10s %10s %10s %12s %12s %8s %10s %12s %12s\n", "layout", "build ms", "trace ms", "Mrays/s", "BVH bytes",
+                "tri bytes", "memory", "traversed", "misses/ray", "pages/ray");
+    const size_t baseBytes = results[0].bvhBytes + results[0].triangleBytes;
+    for (const Result& result : results) {
+        printResult(result);
+        std::printf("%8.0f%%", baseBytes > 0 ? 100.0 * (result.bvhBytes + result.triangleBytes) / baseBytes : 0.0);
+        std::printf("%10.0f%%", results[0].traversedBytes > 0 ? 100.0 * result.traversedBytes / results[0].traversedBytes : 0.0);
+        if (result.cacheMissesPerRay >= 0.0f) {
+            std::printf(" %12.2f %12.2f\n", result.cacheMissesPerRay, result.pageMissesPerRay);
+        } else {
+            std::printf(" %12s %12s\n", "-", "-");
+        }
+    }
+
+#if TRAVERSAL_STATS_ENABLED
+    std::printf("\n%-20s %12s %12s %12s\n", "per ray", "nodes", "boxes", "primitives");
+    double rayCount = static_cast<double>(width) * height;
+    for (const Result& result : results) {
+        std::printf("%-20s %12.2f %12.2f %12.2f\n", result.name.c_str(), result.stats.nodesVisited / rayCount,
+                    result.stats.boxTests / rayCount, result.stats.primTests / rayCount);
+    }
+#endif
+
+    return results;
+}
+
+Camera Benchmark::frameScene(const Scene& scene) const
+{
+    // Look at the scene from above one corner, far enough back to see all of it
+    AABB bounds = scene.getBounds();
+    glm::vec3 center = bounds.centroid();
+    float radius = glm::max(glm::length(bounds.bmax - bounds.bmin) * 0.5f, 1e-3f);
+    glm::vec3 position = center + glm::normalize(glm::vec3(-1.0f, 0.75f, -1.0f)) * radius * 1.5f;
+
+    return Camera(position, center, glm::vec3(0, 1, 0), 90, (float)width / height, 0.0f, 1.0f);
+}
+
+Benchmark::Result Benchmark::measure(const std::string& name, Scene& scene, const BVHBuildSettings& settings, const Camera& cam,
+                                     TraceMode traceMode) const
+{
+    Result result;
+    result.name = name;
+    result.bvhBytes = 0;
+    result.traversedBytes = 0;
+    result.triangleBytes = 0;
+
+    auto buildStart = std::chrono::high_resolution_clock::now();
+    for (const auto& mesh : scene.getMeshes()) {
+        mesh->buildBVH(settings);
+    }
+    result.buildMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+
+    for (const auto& mesh : scene.getMeshes()) {
+        result.bvhBytes += mesh->getBVHMemory();
+        result.traversedBytes += mesh->getTraversedBVHMemory();
+        result.triangleBytes += mesh->getTriangleMemory();
+    }
+
+    traversalStats() = TraversalStats();
+    auto traceStart = std::chrono::high_resolution_clock::now();
+    if (traceMode == TraceMode::Streams) {
+        traceStream(scene, cam);
+    } else if (traceMode != TraceMode::PerRay) {
+        traceTiles(scene, cam, traceMode);
+    } else {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                Ray ray = cam.generateRay(static_cast<float>(x) / width, static_cast<float>(y) / height);
+                HitRecord hit;
+                scene.intersect(ray, hit);
+            }
+        }
+    }
+    result.traceMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - traceStart).count();
+    result.stats = traversalStats();
+    result.mraysPerSecond = (width * height) / (result.traceMs * 1000.0f);
+
+    result.cacheMissesPerRay = -1.0f;
+    result.pageMissesPerRay = -1.0f;
+    if (settings.layout == BVHLayout::Binary && !settings.compressed && settings.leafGroupSize <= 1 && traceMode == TraceMode::PerRay) {
+        simulateCache(scene, cam, result);
+    }
+
+    return result;
+}
+
+void Benchmark::traceTiles(const Scene& scene, const Camera& cam, TraceMode traceMode) const
+{
+    Ray rays[MAX_TILE_RAYS];
+    HitRecord hits[MAX_TILE_RAYS];
+
+    for (int tileY = 0; tileY < height; tileY += TILE_SIZE) {
+        for (int tileX = 0; tileX < width; tileX += TILE_SIZE) {
+            int tileWidth = std::min(TILE_SIZE, width - tileX);
+            int tileHeight = std::min(TILE_SIZE, height - tileY);
+
+            uint32_t rayCount = 0;
+            for (int y = tileY; y < tileY + tileHeight; y++) {
+                for (int x = tileX; x < tileX + tileWidth; x++) {
+                    rays[rayCount] = cam.generateRay(static_cast<float>(x) / width, static_cast<float>(y) / height);
+                    hits[rayCount] = HitRecord();
+                    rayCount++;
+                }
+            }
+
+            if (traceMode == TraceMode::Packets) {
+                RayPacket<TILE_SIZE * TILE_SIZE> packet;
+                for (uint32_t i = 0; i < rayCount; i++) {
+                    packet.set(i, rays[i]);
+                }
+                scene.intersectPacket(packet, packet.lanes(rayCount), hits);
+                continue;
+            }
+
+            Frustum frustum = cam.generateFrustum(static_cast<float>(tileX) / width, static_cast<float>(tileY) / height,
+                                                  static_cast<float>(tileX + tileWidth - 1) / width,
+                                                  static_cast<float>(tileY + tileHeight - 1) / height);
+            scene.intersectTile(frustum, rays, rayCount, hits);
+        }
+    }
+}
+
+void Benchmark::traceStream(const Scene& scene, const Camera& cam) const
+{
+    // Rays go in row by row, binning the stream is part of the measured time
+    std::vector<Ray> rays;
+    rays.reserve(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            rays.push_back(cam.generateRay(static_cast<float>(x) / width, static_cast<float>(y) / height));
+        }
+    }
+    std::vector<HitRecord> hits(rays.size());
+
+    RayStream stream;
+    stream.intersect(scene, rays.data(), rays.size(), hits.data());
+}
+
+void Benchmark::simulateCache(const Scene& scene, const Camera& cam, Result& result) const
+{
+    // 32 KB 8 way L1 data cache and a 64 entry TLB over 4 KB pages, typical desktop numbers
+    CacheModel cache(32 * 1024, 64, 8);
+    CacheModel tlb(64 * 4096, 4096, 64);
+    auto touch = [&](const void* address) {
+        cache.access(address);
+        tlb.access(address);
+    };
+
+    // Instances are tested in order instead of through the top level BVH, only the bottom level is modelled
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            Ray ray = cam.generateRay(static_cast<float>(x) / width, static_cast<float>(y) / height);
+            float closestT = std::numeric_limits<float>::max();
+
+            for (const MeshInstance& instance : scene.getInstances()) {
+                if (!instance.mesh) continue;
+                if (BVH::intersectAABB(ray.origin, ray.invDirection, instance.worldBounds.bmin,
+                                       instance.worldBounds.bmax, closestT) == std::numeric_limits<float>::max()) continue;
+
+                Ray localRay(glm::vec3(instance.invTransform * glm::vec4(ray.origin, 1.0f)),
+                             glm::vec3(instance.invTransform * glm::vec4(ray.direction, 0.0f)));
+                auto traceMesh = [&](const auto& triangles) {
+                    instance.mesh->getBVH().intersect(localRay, closestT, [&](uint32_t triIdx) {
+                        // Both ends, a record straddling two cache lines costs both
+                        touch(&triangles[triIdx]);
+                        touch(reinterpret_cast<const char*>(&triangles[triIdx] + 1) - 1);
+                        float t, u, v;
+                        if (triangles[triIdx].intersect(localRay, closestT, t, u, v)) closestT = t;
+                    }, touch);
+                };
+
+                if (instance.mesh->getTriangleTest() == TriangleTest::BaldwinWeber) {
+                    traceMesh(instance.mesh->getAffineTriangles());
+                } else {
+                    traceMesh(instance.mesh->getHotTriangles());
+                }
+            }
+        }
+    }
+
+    float rayCount = static_cast<float>(width) * height;
+    result.cacheMissesPerRay = cache.misses / rayCount;
+    result.pageMissesPerRay = tlb.misses / rayCount;
+}
+
+void Benchmark::printResult(const Result& result)
+{
+    std::printf("%-20s %10.2f %10.2f %10.2f %12zu %12zu", result.name.c_str(), result.buildMs, result.traceMs,
+                result.mraysPerSecond, result.bvhBytes, result.triangleBytes);
+}
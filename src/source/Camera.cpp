@@ -90,6 +90,17 @@ Ray Camera::generateRay(float u, float v) const {
     return Ray(position, rayDirection);
 }
 
+Frustum Camera::generateFrustum(float u0, float v0, float u1, float v1) const {
+    // All rays start at the camera position, so the corner rays span the frustum
+    glm::vec3 corners[4] = {
+        generateRay(u0, v0).direction,
+        generateRay(u1, v0).direction,
+        generateRay(u1, v1).direction,
+        generateRay(u0, v1).direction,
+    };
+    return Frustum::fromCorners(position, corners);
+}
+
 // Get the view matrix (camera transformation)
 glm::mat4 Camera::getViewMatrix() const {
     return glm::lookAt(position, position + direction, up);
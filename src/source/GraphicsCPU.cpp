@@ -9,6 +9,7 @@
 #include <iostream>
 #include <glm/gtx/intersect.hpp> // If you want a library function for ray-triangle
 #include <string>
+#include <algorithm>
 #include <chrono>
 #include <filesystem> // C++17 feature
 
@@ -92,10 +93,9 @@ void GraphicsCPU::renderLoop()
     std::uniform_real_distribution<float> distZ(-15.0f, 0.0f);
 
     int circleCount = 2;
-    circles.resize(circleCount);
-    for(int i = 0; i < circles.size(); i++)
+    for(int i = 0; i < circleCount; i++)
     {
-        circles[i] = Circle(glm::vec3(distX(gen), distY(gen), distZ(gen)), 0.5f);
+        addCircle(Circle(glm::vec3(distX(gen), distY(gen), distZ(gen)), 0.5f));
     }
 
     while (!glfwWindowShouldClose(window)) 
@@ -105,57 +105,27 @@ void GraphicsCPU::renderLoop()
         float deltaTime = std::chrono::duration<float, std::milli>(currentTime - lastTime).count();
         lastTime = currentTime;
 
-        std::cout << deltaTime << " ms" << std::endl;
+        std::cout << deltaTime << " ms";
+#if TRAVERSAL_STATS_ENABLED
+        std::cout << ", " << frameStats.nodesVisited << " nodes, " << frameStats.boxTests << " boxes, "
+                  << frameStats.primTests << " primitives";
+#endif
+        std::cout << std::endl;
 
         // Handle input for movement and camera interaction
         handleInput(deltaTime);
+
+        // Pick up instances added, moved or removed since the last frame
+        scene.update();
         
         // Clear framebuffer
         std::fill(framebuffer.begin(), framebuffer.end(), 0.0f);
+        traversalStats() = TraversalStats();
         
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                // Generate a ray for the current pixel
-                float u = static_cast<float>(x) / width;
-                float v = static_cast<float>(y) / height;
-                Ray ray = cam.generateRay(u, v);
-
-                glm::vec3 finalColor(0.0f); // Default to black
-                float closestT = std::numeric_limits<float>::max();
-                
-                //Go over all meshes
-                for (TriangleMesh& mesh : meshes) {
-                    for (Triangle& triangle : mesh.getTriangles()) {
-                        // Perform ray-triangle intersection
-                        auto hit = triangle.intersect(ray, mesh.getTextures());
-                        if (hit && hit->t < closestT) {
-                            closestT = hit->t;
-                            finalColor = hit->color * 0.5f; // Convert normal to color
-                        }
-                    }
-                }
-
-                for (size_t i = 0; i < circleCount; i++)
-                {
-                    //Do the plane intersection separately
-                    auto cirhit = circles.at(i).intersect(ray);
-                    if (cirhit && cirhit->t < closestT) {
-                        closestT = cirhit->t;
-                        finalColor = cirhit->normal * 0.5f;
-                    }
-                }
-
-                //Do the plane intersection separately
-                auto plahit = plane.intersect(ray);
-                if (plahit && plahit->t < closestT) {
-                    closestT = plahit->t;
-                    finalColor = plahit->color * 0.5f;
-                }
+        tracePrimaryRays();
+        shadePrimaryHits(plane);
 
-                // Set the pixel color in the framebuffer
-                setPixel(x, y, finalColor.r, finalColor.g, finalColor.b);
-            }
-        }
+        frameStats = traversalStats();
 
         // Draw the framebuffer
         glDrawPixels(width, height, GL_RGB, GL_FLOAT, framebuffer.data());
@@ -164,6 +134,118 @@ void GraphicsCPU::renderLoop()
     }
 };
 
+void GraphicsCPU::tracePrimaryRays()
+{
+    // Tile order keeps the rays of a tile contiguous for tile traversal and puts neighbours next to each other
+    // in the stream, tiles at the right and top edge may be smaller
+    primaryRays.clear();
+    primaryPixels.clear();
+    for (int tileY = 0; tileY < height; tileY += TILE_SIZE) {
+        for (int tileX = 0; tileX < width; tileX += TILE_SIZE) {
+            for (int y = tileY; y < std::min(tileY + TILE_SIZE, height); y++) {
+                for (int x = tileX; x < std::min(tileX + TILE_SIZE, width); x++) {
+                    primaryRays.push_back(cam.generateRay(static_cast<float>(x) / width, static_cast<float>(y) / height));
+                    primaryPixels.push_back(y * width + x);
+                }
+            }
+        }
+    }
+    primaryHits.assign(primaryRays.size(), HitRecord());
+    primaryCost.resize(primaryRays.size());
+
+    //One traversal finds the closest instance or circle, each instance walks the BVH of its mesh
+    if (traversalMode == TraversalMode::Streams) {
+        rayStream.intersect(scene, primaryRays.data(), primaryRays.size(), primaryHits.data(), primaryCost.data());
+    } else if (traversalMode == TraversalMode::Tiles) {
+        uint32_t first = 0;
+        for (int tileY = 0; tileY < height; tileY += TILE_SIZE) {
+            for (int tileX = 0; tileX < width; tileX += TILE_SIZE) {
+                int tileWidth = std::min(TILE_SIZE, width - tileX);
+                int tileHeight = std::min(TILE_SIZE, height - tileY);
+                uint32_t rayCount = static_cast<uint32_t>(tileWidth * tileHeight);
+
+                uint64_t workBefore = traversalStats().total();
+                Frustum frustum = cam.generateFrustum(static_cast<float>(tileX) / width, static_cast<float>(tileY) / height,
+                                                      static_cast<float>(tileX + tileWidth - 1) / width,
+                                                      static_cast<float>(tileY + tileHeight - 1) / height);
+                scene.intersectTile(frustum, &primaryRays[first], rayCount, &primaryHits[first]);
+                std::fill(&primaryCost[first], &primaryCost[first] + rayCount,
+                          static_cast<float>(traversalStats().total() - workBefore) / rayCount);
+                first += rayCount;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < primaryRays.size(); i++) {
+            uint64_t workBefore = traversalStats().total();
+            scene.intersect(primaryRays[i], primaryHits[i]);
+            primaryCost[i] = static_cast<float>(traversalStats().total() - workBefore);
+        }
+    }
+}
+
+void GraphicsCPU::shadePrimaryHits(const Plane& plane)
+{
+    surfacePoints.clear();
+    shadowRays.clear();
+    for (size_t i = 0; i < primaryRays.size(); i++) {
+        int pixel = primaryPixels[i];
+        if (renderMode == RenderMode::Heatmap) {
+            glm::vec3 heat = heatmapColor(primaryCost[i]);
+            setPixel(pixel % width, pixel / width, heat.r, heat.g, heat.b);
+            continue;
+        }
+
+        // Traversal only found the closest hit, it is shaded here unless the plane is in front of it.
+        // Misses stay black.
+        Ray ray = primaryRays[i];
+        ray.tmax = primaryHits[i].t;
+        HitResult hit;
+        HitRecord planeHit;
+        if (plane.intersect(ray, planeHit)) {
+            hit = plane.shade(ray, planeHit.t);
+        } else if (primaryHits[i].hit()) {
+            hit = scene.shade(ray, primaryHits[i]);
+        } else {
+            continue;
+        }
+
+        // Light the side the ray came from, and start shadow rays just off the surface so they miss it
+        glm::vec3 normal = glm::dot(hit.normal, ray.direction) > 0.0f ? -hit.normal : hit.normal;
+        glm::vec3 origin = hit.point + normal * 1e-4f;
+        surfacePoints.push_back({ pixel, hit.point, normal, hit.color });
+        for (const PointLight& pointLight : lights) {
+            // Unnormalized direction puts the light at t = 1, so anything before it blocks it
+            shadowRays.emplace_back(origin, pointLight.position - origin, Ray::DEFAULT_TMIN, 1.0f);
+        }
+    }
+
+    // Shadow rays of neighbouring points head for the same light, the stream traces them together
+    shadowBlocked.resize(shadowRays.size());
+    rayStream.occluded(scene, shadowRays.data(), shadowRays.size(), shadowBlocked.data());
+
+    size_t shadowIdx = 0;
+    for (const SurfacePoint& surface : surfacePoints) {
+        glm::vec3 light(0.5f); // Ambient
+        for (const PointLight& pointLight : lights) {
+            const Ray& shadowRay = shadowRays[shadowIdx];
+            bool blocked = shadowBlocked[shadowIdx] || plane.occludes(shadowRay);
+            shadowIdx++;
+            if (blocked) continue;
+            light += pointLight.computeLighting(surface.point, surface.normal);
+        }
+
+        glm::vec3 finalColor = surface.color * light;
+        setPixel(surface.pixel % width, surface.pixel / width, finalColor.r, finalColor.g, finalColor.b);
+    }
+}
+
+glm::vec3 GraphicsCPU::heatmapColor(float cost)
+{
+    // Blue for cheap rays, through green, to red at HEATMAP_MAX_COST and above
+    float t = glm::clamp(cost / HEATMAP_MAX_COST, 0.0f, 1.0f) * 4.0f;
+    return glm::clamp(glm::vec3(1.5f - std::abs(t - 3.0f), 1.5f - std::abs(t - 2.0f), 1.5f - std::abs(t - 1.0f)), 0.0f, 1.0f);
+}
+
 void GraphicsCPU::setPixel(int x, int y, float r, float g, float b)
 { 
     // Set the pixel color
@@ -243,6 +325,27 @@ void GraphicsCPU::handleInput(float deltaTime)
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
 
+    // Toggle the traversal cost heatmap on the H key press, not every frame it is held
+    bool heatmapKeyDown = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+    if (heatmapKeyDown && !heatmapKeyPressed) {
+        renderMode = renderMode == RenderMode::Heatmap ? RenderMode::Shaded : RenderMode::Heatmap;
+#if !TRAVERSAL_STATS_ENABLED
+        std::cout << "Heatmap needs a build with CONSTATINE_TRAVERSAL_STATS" << std::endl;
+#endif
+    }
+    heatmapKeyPressed = heatmapKeyDown;
+
+    // T cycles primary rays through streams, tile traversal and one traversal per pixel
+    bool tileKeyDown = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+    if (tileKeyDown && !tileKeyPressed) {
+        switch (traversalMode) {
+        case TraversalMode::Streams: traversalMode = TraversalMode::Tiles; std::cout << "Tile traversal" << std::endl; break;
+        case TraversalMode::Tiles: traversalMode = TraversalMode::PerRay; std::cout << "Per ray traversal" << std::endl; break;
+        default: traversalMode = TraversalMode::Streams; std::cout << "Stream traversal" << std::endl; break;
+        }
+    }
+    tileKeyPressed = tileKeyDown;
+
     // Save the current frame to a PNG file when the 'P' key is pressed
     // Note: This will save the frame to the 'frames' directory
     if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
@@ -301,7 +404,5 @@ bool GraphicsCPU::saveFrame(const std::string &filename)
 
 void GraphicsCPU::shutdown()
 {
-    circles.clear();
-    
     glfwTerminate();
 };
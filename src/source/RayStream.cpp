@@ -0,0 +1,81 @@
+#include "../headers/RayStream.h"
+
+#include <algorithm>
+
+void RayStream::sortIntoBins(const Scene& scene, const Ray* rays, size_t count)
+{
+    // Origins outside the scene, like the camera, are clamped into the border cells
+    AABB bounds = scene.getBounds();
+    bool hasBounds = bounds.bmin.x <= bounds.bmax.x;
+    glm::vec3 scale = hasBounds ? glm::vec3(STREAM_GRID) / glm::max(bounds.bmax - bounds.bmin, glm::vec3(1e-6f)) : glm::vec3(0.0f);
+    glm::vec3 origin = hasBounds ? bounds.bmin : glm::vec3(0.0f);
+
+    // Counting sort on the bin, stable so every bin keeps the order the rays came in
+    rayBins.resize(count);
+    binStart.assign(BIN_COUNT + 1, 0);
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 cellPos = glm::clamp((rays[i].origin - origin) * scale, glm::vec3(0.0f), glm::vec3(STREAM_GRID - 1));
+        int cell = (static_cast<int>(cellPos.z) * STREAM_GRID + static_cast<int>(cellPos.y)) * STREAM_GRID + static_cast<int>(cellPos.x);
+        rayBins[i] = static_cast<uint16_t>(cell * 8 + rays[i].signs);
+        binStart[rayBins[i] + 1]++;
+    }
+    for (int bin = 0; bin < BIN_COUNT; bin++) {
+        binStart[bin + 1] += binStart[bin];
+    }
+
+    order.resize(count);
+    std::vector<uint32_t> cursor(binStart.begin(), binStart.end() - 1);
+    for (size_t i = 0; i < count; i++) {
+        order[cursor[rayBins[i]]++] = static_cast<uint32_t>(i);
+    }
+}
+
+template<typename Fn>
+void RayStream::forEachPacket(Fn&& fn) const
+{
+    for (int bin = 0; bin < BIN_COUNT; bin++) {
+        for (uint32_t first = binStart[bin]; first < binStart[bin + 1]; first += STREAM_PACKET) {
+            fn(&order[first], std::min<uint32_t>(STREAM_PACKET, binStart[bin + 1] - first));
+        }
+    }
+}
+
+void RayStream::intersect(const Scene& scene, const Ray* rays, size_t count, HitRecord* hits, float* cost)
+{
+    sortIntoBins(scene, rays, count);
+
+    RayPacket<STREAM_PACKET> packet;
+    HitRecord packetHits[STREAM_PACKET];
+    forEachPacket([&](const uint32_t* rayIndices, uint32_t rayCount) {
+        for (uint32_t i = 0; i < rayCount; i++) {
+            packetHits[i] = hits[rayIndices[i]];
+            packet.set(i, rays[rayIndices[i]]);
+        }
+
+        uint64_t workBefore = traversalStats().total();
+        scene.intersectPacket(packet, packet.lanes(rayCount), packetHits);
+        float packetCost = static_cast<float>(traversalStats().total() - workBefore) / rayCount;
+
+        for (uint32_t i = 0; i < rayCount; i++) {
+            hits[rayIndices[i]] = packetHits[i];
+            if (cost) cost[rayIndices[i]] = packetCost;
+        }
+    });
+}
+
+void RayStream::occluded(const Scene& scene, const Ray* rays, size_t count, uint8_t* blocked)
+{
+    sortIntoBins(scene, rays, count);
+
+    RayPacket<STREAM_PACKET> packet;
+    forEachPacket([&](const uint32_t* rayIndices, uint32_t rayCount) {
+        for (uint32_t i = 0; i < rayCount; i++) {
+            packet.set(i, rays[rayIndices[i]]);
+        }
+
+        PacketMask hit = scene.occludedPacket(packet, packet.lanes(rayCount));
+        for (uint32_t i = 0; i < rayCount; i++) {
+            blocked[rayIndices[i]] = (hit >> i) & 1;
+        }
+    });
+}
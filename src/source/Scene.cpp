@@ -0,0 +1,402 @@
+#include "../headers/Scene.h"
+#include "../headers/Ray.h"
+#include "../headers/BVHCache.h"
+
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <iostream>
+
+void Scene::loadGLTF(const tinygltf::Model& model, const BVHCache* cache)
+{
+    // Every glTF mesh becomes one bottom level structure, no matter how many nodes use it
+    auto textures = TriangleMesh::loadTextures(model);
+    std::vector<std::shared_ptr<TriangleMesh>> modelMeshes;
+    if (!cache || !cache->load(model.meshes.size(), textures, modelMeshes)) {
+        for (const auto& gltfMesh : model.meshes) {
+            auto mesh = std::make_shared<TriangleMesh>();
+            mesh->loadGLTFMesh(model, gltfMesh, textures);
+            modelMeshes.push_back(mesh);
+        }
+        if (cache) cache->save(modelMeshes);
+    }
+
+    if (model.scenes.empty()) {
+        // No node hierarchy, place every mesh once at the origin
+        for (const auto& mesh : modelMeshes) {
+            addInstance(mesh);
+        }
+        return;
+    }
+
+    const auto& scene = model.scenes[model.defaultScene >= 0 ? model.defaultScene : 0];
+    for (int nodeIndex : scene.nodes) {
+        loadNode(model, nodeIndex, glm::mat4(1.0f), modelMeshes);
+    }
+
+    std::cout << "Scene: " << meshes.size() << " meshes, " << getInstanceCount() << " instances" << std::endl;
+}
+
+void Scene::loadNode(const tinygltf::Model& model, int nodeIndex, const glm::mat4& parentTransform,
+                     const std::vector<std::shared_ptr<TriangleMesh>>& modelMeshes)
+{
+    const auto& node = model.nodes[nodeIndex];
+    glm::mat4 transform = parentTransform * nodeTransform(node);
+
+    if (node.mesh >= 0) {
+        addInstance(modelMeshes[node.mesh], transform);
+    }
+
+    for (int child : node.children) {
+        loadNode(model, child, transform, modelMeshes);
+    }
+}
+
+glm::mat4 Scene::nodeTransform(const tinygltf::Node& node)
+{
+    // Either a full column major matrix or separate translation, rotation and scale
+    if (node.matrix.size() == 16) {
+        glm::dmat4 matrix = glm::make_mat4(node.matrix.data());
+        return glm::mat4(matrix);
+    }
+
+    glm::mat4 transform(1.0f);
+    if (node.translation.size() == 3) {
+        transform = glm::translate(transform, glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+    }
+    if (node.rotation.size() == 4) {
+        // glTF stores quaternions as x, y, z, w
+        glm::quat rotation(static_cast<float>(node.rotation[3]), static_cast<float>(node.rotation[0]),
+                           static_cast<float>(node.rotation[1]), static_cast<float>(node.rotation[2]));
+        transform = transform * glm::mat4_cast(rotation);
+    }
+    if (node.scale.size() == 3) {
+        transform = glm::scale(transform, glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+    }
+    return transform;
+}
+
+AABB Scene::transformBounds(const glm::vec3& aabbMin, const glm::vec3& aabbMax, const glm::mat4& transform)
+{
+    AABB bounds;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner(i & 1 ? aabbMax.x : aabbMin.x, i & 2 ? aabbMax.y : aabbMin.y, i & 4 ? aabbMax.z : aabbMin.z);
+        bounds.grow(glm::vec3(transform * glm::vec4(corner, 1.0f)));
+    }
+    return bounds;
+}
+
+InstanceId Scene::addInstance(const std::shared_ptr<TriangleMesh>& mesh, const glm::mat4& transform)
+{
+    if (std::find(meshes.begin(), meshes.end(), mesh) == meshes.end()) {
+        meshes.push_back(mesh);
+    }
+
+    MeshInstance instance;
+    instance.mesh = mesh;
+    instance.transform = transform;
+    instance.invTransform = glm::inverse(transform);
+    updateInstanceBounds(instance);
+
+    // A slot removed since the last rebuild is still a leaf of the top level tree, filling it only needs a refit
+    if (!freeInstances.empty()) {
+        InstanceId id = freeInstances.back();
+        freeInstances.pop_back();
+        instances[id] = instance;
+        if (inTopLevel[id]) {
+            boundsDirty = true;
+        } else {
+            tlasDirty = true;
+        }
+        return id;
+    }
+
+    instances.push_back(instance);
+    inTopLevel.push_back(false);
+    tlasDirty = true;
+    return static_cast<InstanceId>(instances.size() - 1);
+}
+
+void Scene::removeInstance(InstanceId id)
+{
+    MeshInstance& instance = instances[id];
+    if (!instance.mesh) return;
+
+    std::shared_ptr<TriangleMesh> mesh = instance.mesh;
+    instance.mesh.reset();
+    // The inverted empty box leaves its parents' bounds alone when the top level is refitted, but the slab test
+    // still passes for it, so its leaf is entered whenever the parent is. The leaf callbacks skip it by its null mesh.
+    instance.worldBounds = AABB();
+    freeInstances.push_back(id);
+    boundsDirty = true;
+
+    // Drop the mesh once nothing places it anymore
+    bool used = std::any_of(instances.begin(), instances.end(), [&](const MeshInstance& other) { return other.mesh == mesh; });
+    if (!used) {
+        meshes.erase(std::remove(meshes.begin(), meshes.end(), mesh), meshes.end());
+    }
+}
+
+void Scene::setTransform(InstanceId id, const glm::mat4& transform)
+{
+    MeshInstance& instance = instances[id];
+    if (!instance.mesh) return;
+
+    instance.transform = transform;
+    instance.invTransform = glm::inverse(transform);
+    updateInstanceBounds(instance);
+    boundsDirty = true;
+}
+
+void Scene::updateMesh(const std::shared_ptr<TriangleMesh>& mesh)
+{
+    mesh->refitBVH();
+    for (MeshInstance& instance : instances) {
+        if (instance.mesh == mesh) {
+            updateInstanceBounds(instance);
+            boundsDirty = true;
+        }
+    }
+}
+
+void Scene::updateInstanceBounds(MeshInstance& instance)
+{
+    instance.worldBounds = AABB();
+    const std::vector<BVHNode>& blasNodes = instance.mesh->getBVH().getNodes();
+    if (!blasNodes.empty()) {
+        instance.worldBounds = transformBounds(blasNodes[0].aabbMin, blasNodes[0].aabbMax, instance.transform);
+    }
+}
+
+void Scene::addSphere(const Circle& sphere)
+{
+    spheres.add(sphere);
+    spheresDirty = true;
+    tlasDirty = true;
+}
+
+std::vector<AABB> Scene::objectBounds() const
+{
+    std::vector<AABB> bounds;
+    bounds.reserve(objects.size());
+    for (const SceneObject& object : objects) {
+        bounds.push_back(object.type == SceneObjectType::Spheres ? spheres.getBounds() : instances[object.index].worldBounds);
+    }
+    return bounds;
+}
+
+void Scene::update()
+{
+    if (boundsDirty && !tlasDirty) {
+        tlas.refit(objectBounds());
+        boundsDirty = false;
+        if (!tlas.needsRebuild()) return;
+        tlasDirty = true;
+    }
+    if (!tlasDirty) return;
+
+    if (spheresDirty) {
+        spheres.build();
+        spheresDirty = false;
+    }
+
+    // Removed slots have no bounds to build over and are left out until they are reused
+    objects.clear();
+    objects.reserve(instances.size() + 1);
+    for (uint32_t i = 0; i < instances.size(); i++) {
+        inTopLevel[i] = instances[i].mesh != nullptr;
+        if (inTopLevel[i]) objects.push_back({SceneObjectType::MeshInstance, i});
+    }
+    if (!spheres.empty()) objects.push_back({SceneObjectType::Spheres, 0});
+
+    tlas.build(objectBounds());
+    tlasDirty = false;
+    boundsDirty = false;
+}
+
+AABB Scene::getBounds() const
+{
+    AABB bounds;
+    for (const MeshInstance& instance : instances) {
+        bounds.grow(instance.worldBounds);
+    }
+    if (!spheres.empty()) bounds.grow(spheres.getBounds());
+    return bounds;
+}
+
+template<unsigned Flags>
+bool Scene::intersect(Ray& ray, HitRecord& hit) const
+{
+    bool found = false;
+    tlas.intersect<Flags>(ray, ray.tmax, [&](uint32_t objectIdx) {
+        const SceneObject& object = objects[objectIdx];
+        if (object.type == SceneObjectType::Spheres) {
+            if (!spheres.intersect<Flags>(ray, hit)) return false;
+            hit.objectId = objectIdx;
+            found = true;
+            return true;
+        }
+
+        const MeshInstance& instance = instances[object.index];
+        if (!instance.mesh) return false; // Removed since the last rebuild
+
+        // The direction is not renormalized so t means the same distance in both spaces
+        Ray local = localRay(instance, ray);
+        if (!instance.mesh->intersect<Flags>(local, hit)) return false;
+        ray.tmax = local.tmax;
+        hit.objectId = objectIdx;
+        found = true;
+        return true;
+    });
+    return found;
+}
+
+template bool Scene::intersect<RAY_CLOSEST_HIT>(Ray& ray, HitRecord& hit) const;
+template bool Scene::intersect<RAY_CULL_BACKFACES>(Ray& ray, HitRecord& hit) const;
+template bool Scene::intersect<RAY_NO_UVS>(Ray& ray, HitRecord& hit) const;
+template bool Scene::intersect<RAY_ANY_HIT | RAY_NO_UVS>(Ray& ray, HitRecord& hit) const;
+
+HitResult Scene::shade(const Ray& ray, const HitRecord& hit) const
+{
+    const SceneObject& object = objects[hit.objectId];
+    if (object.type == SceneObjectType::Spheres) {
+        return spheres.shade(ray, hit);
+    }
+
+    const MeshInstance& instance = instances[object.index];
+    HitResult result = instance.mesh->shade(localRay(instance, ray), hit);
+    result.point = ray.at(hit.t);
+    result.normal = glm::normalize(glm::transpose(glm::mat3(instance.invTransform)) * result.normal);
+    return result;
+}
+
+std::optional<HitResult> Scene::intersect(const Ray& ray) const
+{
+    Ray query = ray;
+    HitRecord hit;
+    if (!intersect(query, hit)) return std::nullopt;
+    return shade(ray, hit);
+}
+
+Ray Scene::localRay(const MeshInstance& instance, const Ray& ray)
+{
+    return Ray(glm::vec3(instance.invTransform * glm::vec4(ray.origin, 1.0f)),
+               glm::vec3(instance.invTransform * glm::vec4(ray.direction, 0.0f)), ray.tmin, ray.tmax);
+}
+
+void Scene::intersectTile(const Frustum& frustum, const Ray* rays, uint32_t rayCount, HitRecord* hits) const
+{
+    float closestT[MAX_TILE_RAYS];
+    for (uint32_t i = 0; i < rayCount; i++) {
+        closestT[i] = rays[i].tmax;
+    }
+
+    tlas.intersectTile(frustum, rays, rayCount, closestT, [&](uint32_t objectIdx, uint32_t firstRay, uint32_t endRay) {
+        const SceneObject& object = objects[objectIdx];
+        if (object.type == SceneObjectType::Spheres) {
+            const uint32_t count = endRay - firstRay;
+            Ray sphereRays[MAX_TILE_RAYS];
+            for (uint32_t i = 0; i < count; i++) {
+                sphereRays[i] = rays[firstRay + i];
+                sphereRays[i].tmax = closestT[firstRay + i];
+            }
+            spheres.intersectTile(frustum, sphereRays, count, hits + firstRay);
+
+            for (uint32_t i = firstRay; i < endRay; i++) {
+                if (hits[i].t >= closestT[i]) continue;
+                hits[i].objectId = objectIdx;
+                closestT[i] = hits[i].t;
+            }
+            return;
+        }
+
+        const MeshInstance& instance = instances[object.index];
+        if (!instance.mesh) return;
+
+        // The rays and the frustum move into object space together, t stays the same as in intersect
+        const uint32_t count = endRay - firstRay;
+        Ray localRays[MAX_TILE_RAYS];
+        for (uint32_t i = 0; i < count; i++) {
+            localRays[i] = localRay(instance, rays[firstRay + i]);
+            localRays[i].tmax = closestT[firstRay + i];
+        }
+
+        instance.mesh->intersectTile(frustum.transformed(instance.transform), localRays, count, hits + firstRay);
+
+        // Only rays whose distance dropped were hit by this instance
+        for (uint32_t i = firstRay; i < endRay; i++) {
+            if (hits[i].t >= closestT[i]) continue;
+            hits[i].objectId = objectIdx;
+            closestT[i] = hits[i].t;
+        }
+    });
+}
+
+template<int N>
+void Scene::intersectPacket(RayPacket<N>& packet, PacketMask active, HitRecord* hits) const
+{
+    tlas.intersectPacket(packet, active, [&](uint32_t objectIdx, PacketMask mask) {
+        const SceneObject& object = objects[objectIdx];
+        if (object.type == SceneObjectType::Spheres) {
+            // World space already, so the set lowers packet.closestT itself
+            float closestT[N];
+            std::copy(packet.closestT, packet.closestT + N, closestT);
+            spheres.intersectPacket(packet, mask, hits);
+
+            for (int lane = 0; lane < N; lane++) {
+                if ((mask & (PacketMask(1) << lane)) && packet.closestT[lane] < closestT[lane]) hits[lane].objectId = objectIdx;
+            }
+            return;
+        }
+
+        const MeshInstance& instance = instances[object.index];
+        if (!instance.mesh) return;
+
+        // Same lanes in object space, t stays the same as in intersect
+        RayPacket<N> local;
+        for (int lane = 0; lane < N; lane++) {
+            if (mask & (PacketMask(1) << lane)) local.set(lane, localRay(instance, packet.ray(lane)));
+        }
+
+        instance.mesh->intersectPacket(local, mask, hits);
+
+        // Only rays whose distance dropped were hit by this instance
+        for (int lane = 0; lane < N; lane++) {
+            if (!(mask & (PacketMask(1) << lane)) || hits[lane].t >= packet.closestT[lane]) continue;
+            hits[lane].objectId = objectIdx;
+            packet.closestT[lane] = hits[lane].t;
+        }
+    });
+}
+
+template void Scene::intersectPacket(RayPacket<16>& packet, PacketMask active, HitRecord* hits) const;
+template void Scene::intersectPacket(RayPacket<64>& packet, PacketMask active, HitRecord* hits) const;
+
+bool Scene::occluded(const Ray& ray) const
+{
+    Ray query = ray;
+    HitRecord hit;
+    return intersect<RAY_ANY_HIT | RAY_NO_UVS>(query, hit);
+}
+
+template<int N>
+PacketMask Scene::occludedPacket(RayPacket<N>& packet, PacketMask active) const
+{
+    return tlas.occludedPacket(packet, active, [&](uint32_t objectIdx, PacketMask mask) {
+        const SceneObject& object = objects[objectIdx];
+        if (object.type == SceneObjectType::Spheres) return spheres.occludedPacket(packet, mask);
+
+        const MeshInstance& instance = instances[object.index];
+        if (!instance.mesh) return PacketMask(0);
+
+        RayPacket<N> local;
+        for (int lane = 0; lane < N; lane++) {
+            if (mask & (PacketMask(1) << lane)) local.set(lane, localRay(instance, packet.ray(lane)));
+        }
+        return instance.mesh->occludedPacket(local, mask);
+    });
+}
+
+template PacketMask Scene::occludedPacket(RayPacket<16>& packet, PacketMask active) const;
+template PacketMask Scene::occludedPacket(RayPacket<64>& packet, PacketMask active) const;
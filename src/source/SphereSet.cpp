@@ -0,0 +1,137 @@
+#include "../headers/SphereSet.h"
+#include "../headers/Ray.h"
+
+#include <algorithm>
+
+AABB SphereSet::sphereBounds(const Circle& sphere)
+{
+    glm::vec3 radius(sphere.getRadius());
+    return {sphere.getPosition() - radius, sphere.getPosition() + radius};
+}
+
+AABB SphereSet::getBounds() const
+{
+    const std::vector<BVHNode>& nodes = bvh.getNodes();
+    if (nodes.empty()) return AABB();
+    return {nodes[0].aabbMin, nodes[0].aabbMax};
+}
+
+void SphereSet::build()
+{
+    std::vector<AABB> bounds(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++) {
+        bounds[i] = sphereBounds(spheres[i]);
+    }
+
+    // The SAH counts leaves in whole blocks, so it keeps them close to full
+    BVHBuildSettings settings;
+    settings.leafGroupSize = SPHERE_BLOCK_SIZE;
+    bvh.build(bounds, settings);
+
+    blocks.clear();
+    const std::vector<uint32_t>& primIndices = bvh.getPrimIndices();
+    leafBlocks.assign(primIndices.size(), 0);
+    for (const BVHNode& node : bvh.getNodes()) {
+        if (!node.isLeaf()) continue;
+
+        leafBlocks[node.leftFirst] = static_cast<uint32_t>(blocks.size());
+        for (uint32_t first = 0; first < node.primCount; first += SPHERE_BLOCK_SIZE) {
+            SphereBlock<SPHERE_BLOCK_SIZE>& block = blocks.emplace_back();
+            block.clear();
+            for (uint32_t lane = 0; lane < SPHERE_BLOCK_SIZE && first + lane < node.primCount; lane++) {
+                uint32_t sphereIdx = primIndices[node.leftFirst + first + lane];
+                block.set(lane, spheres[sphereIdx], sphereIdx);
+            }
+        }
+    }
+}
+
+template<unsigned Flags>
+bool SphereSet::intersect(Ray& ray, HitRecord& hit) const
+{
+    const SphereRay sphereRay = SphereRay::fromRay(ray);
+    bool found = false;
+    bvh.intersectLeaves<Flags>(ray, ray.tmax, [&](uint32_t first, uint32_t count) {
+        const SphereBlock<SPHERE_BLOCK_SIZE>* block = &blocks[leafBlocks[first]];
+        for (uint32_t i = 0; i < count; i += SPHERE_BLOCK_SIZE, block++) {
+            float t;
+            int lane = SphereBlockTest<SPHERE_BLOCK_SIZE>::intersect(*block, ray, sphereRay, ray.tmax, t);
+            if (lane < 0) continue;
+
+            ray.tmax = t;
+            hit.t = t;
+            hit.primId = block->primId[lane];
+            found = true;
+            if constexpr ((Flags & RAY_ANY_HIT) != 0) return true;
+        }
+        return false;
+    });
+    return found;
+}
+
+template bool SphereSet::intersect<RAY_CLOSEST_HIT>(Ray& ray, HitRecord& hit) const;
+template bool SphereSet::intersect<RAY_CULL_BACKFACES>(Ray& ray, HitRecord& hit) const;
+template bool SphereSet::intersect<RAY_NO_UVS>(Ray& ray, HitRecord& hit) const;
+template bool SphereSet::intersect<RAY_ANY_HIT | RAY_NO_UVS>(Ray& ray, HitRecord& hit) const;
+
+HitResult SphereSet::shade(const Ray& ray, const HitRecord& hit) const
+{
+    return spheres[hit.primId].shade(ray, hit.t);
+}
+
+void SphereSet::intersectTile(const Frustum& frustum, const Ray* rays, uint32_t rayCount, HitRecord* hits) const
+{
+    float closestT[MAX_TILE_RAYS];
+    for (uint32_t i = 0; i < rayCount; i++) {
+        closestT[i] = rays[i].tmax;
+    }
+
+    bvh.intersectTile(frustum, rays, rayCount, closestT, [&](uint32_t sphereIdx, uint32_t firstRay, uint32_t endRay) {
+        const Circle& sphere = spheres[sphereIdx];
+        for (uint32_t i = firstRay; i < endRay; i++) {
+            Ray query = rays[i];
+            query.tmax = closestT[i];
+            if (sphere.intersect(query, hits[i])) {
+                hits[i].primId = sphereIdx;
+                closestT[i] = query.tmax;
+            }
+        }
+    });
+}
+
+template<int N>
+void SphereSet::intersectPacket(RayPacket<N>& packet, PacketMask active, HitRecord* hits) const
+{
+    bvh.intersectPacket(packet, active, [&](uint32_t sphereIdx, PacketMask mask) {
+        const Circle& sphere = spheres[sphereIdx];
+        for (int lane = 0; mask != 0; lane++) {
+            if (!(mask & (PacketMask(1) << lane))) continue;
+            mask &= mask - 1;
+            Ray laneRay = packet.ray(lane);
+            if (sphere.intersect(laneRay, hits[lane])) {
+                hits[lane].primId = sphereIdx;
+                packet.closestT[lane] = laneRay.tmax;
+            }
+        }
+    });
+}
+
+template void SphereSet::intersectPacket(RayPacket<16>& packet, PacketMask active, HitRecord* hits) const;
+template void SphereSet::intersectPacket(RayPacket<64>& packet, PacketMask active, HitRecord* hits) const;
+
+template<int N>
+PacketMask SphereSet::occludedPacket(RayPacket<N>& packet, PacketMask active) const
+{
+    return bvh.occludedPacket(packet, active, [&](uint32_t sphereIdx, PacketMask mask) {
+        PacketMask blocked = 0;
+        for (int lane = 0; mask != 0; lane++) {
+            if (!(mask & (PacketMask(1) << lane))) continue;
+            mask &= mask - 1;
+            if (spheres[sphereIdx].occludes(packet.ray(lane))) blocked |= PacketMask(1) << lane;
+        }
+        return blocked;
+    });
+}
+
+template PacketMask SphereSet::occludedPacket(RayPacket<16>& packet, PacketMask active) const;
+template PacketMask SphereSet::occludedPacket(RayPacket<64>& packet, PacketMask active) const;
@@ -1,16 +1,16 @@
 #include "../headers/TriangleMesh.h"
+#include "../headers/Parallel.h"
 
 #include <glm/geometric.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
 #include <iostream>
 
 // Function to load a GLTF model
 void TriangleMesh::loadGLTF(const tinygltf::Model& model)
 {
-    triangles.clear();
-    textures.clear();
-
-    loadTextures(model);
+    clearGeometry();
+    textures = loadTextures(model);
 
     for (const auto& mesh : model.meshes) {
         std::cout << mesh.name << std::endl;
@@ -20,80 +20,563 @@ void TriangleMesh::loadGLTF(const tinygltf::Model& model)
             }
         }
     }
+
+    buildBVH();
+}
+
+void TriangleMesh::loadGLTFMesh(const tinygltf::Model& model, const tinygltf::Mesh& mesh,
+                                const std::shared_ptr<std::vector<Texture>>& sharedTextures)
+{
+    clearGeometry();
+    textures = sharedTextures;
+
+    std::cout << mesh.name << std::endl;
+    for (const auto& primitive : mesh.primitives) {
+        if (primitive.mode == TINYGLTF_MODE_TRIANGLES) {
+            processPrimitive(model, primitive);
+        }
+    }
+
+    buildBVH();
+}
+
+void TriangleMesh::loadCached(const glm::vec3* cachedPositions, const glm::vec3* cachedNormals, const glm::vec2* cachedUVs,
+                              size_t vertexCount, const uint32_t* cachedIndices, size_t indexCount,
+                              const MeshPart* cachedParts, size_t partCount, const BVHNode* nodes, size_t nodeCount,
+                              const uint32_t* primIndices, size_t primIndexCount, const BVHBuildSettings& settings,
+                              const std::shared_ptr<std::vector<Texture>>& sharedTextures)
+{
+    positions.assign(cachedPositions, cachedPositions + vertexCount);
+    normals.assign(cachedNormals, cachedNormals + vertexCount);
+    uvs.assign(cachedUVs, cachedUVs + vertexCount);
+    indices.assign(cachedIndices, cachedIndices + indexCount);
+    parts.assign(cachedParts, cachedParts + partCount);
+    textures = sharedTextures;
+
+    bvhSettings = settings;
+    bvh.assign(nodes, nodeCount, primIndices, primIndexCount);
+    buildWideBVH();
+    updateHotTriangles();
+    buildTriangleBlocks();
+}
+
+void TriangleMesh::clearGeometry()
+{
+    positions.clear();
+    normals.clear();
+    uvs.clear();
+    indices.clear();
+    parts.clear();
+}
+
+void TriangleMesh::addTriangle(const Triangle& triangle, float alphaCutoff)
+{
+    const uint32_t first = static_cast<uint32_t>(positions.size());
+    if (parts.empty() || parts.back().textureIndex != triangle.textureIndex || parts.back().alphaCutoff != alphaCutoff ||
+        parts.back().flatNormals) {
+        parts.push_back({first, triangle.textureIndex, alphaCutoff, false});
+    }
+
+    positions.insert(positions.end(), {triangle.v0, triangle.v1, triangle.v2});
+    normals.insert(normals.end(), 3, triangle.normal);
+    uvs.insert(uvs.end(), {triangle.uv0, triangle.uv1, triangle.uv2});
+    indices.insert(indices.end(), {first, first + 1, first + 2});
+}
+
+const MeshPart& TriangleMesh::partOf(uint32_t vertexIdx) const
+{
+    auto next = std::upper_bound(parts.begin(), parts.end(), vertexIdx,
+                                 [](uint32_t idx, const MeshPart& part) { return idx < part.firstVertex; });
+    return *(next - 1);
+}
+
+Triangle TriangleMesh::getTriangle(uint32_t triIdx) const
+{
+    const uint32_t* tri = &indices[3 * triIdx];
+    const glm::vec3& v0 = positions[tri[0]];
+    const glm::vec3& v1 = positions[tri[1]];
+    const glm::vec3& v2 = positions[tri[2]];
+    const MeshPart& part = partOf(tri[0]);
+    glm::vec3 normal = part.flatNormals ? computeNormal(v0, v1, v2) : normals[tri[0]];
+    return Triangle(v0, v1, v2, normal, uvs[tri[0]], uvs[tri[1]], uvs[tri[2]], part.textureIndex);
+}
+
+bool TriangleMesh::opaqueAt(uint32_t triIdx, float u, float v) const
+{
+    const uint32_t* tri = &indices[3 * triIdx];
+    const MeshPart& part = partOf(tri[0]);
+    if (part.textureIndex < 0 || part.alphaCutoff <= 0.0f) return true;
+
+    glm::vec2 uv = (1.0f - u - v) * uvs[tri[0]] + u * uvs[tri[1]] + v * uvs[tri[2]];
+    return (*textures)[part.textureIndex].sampleAlpha(uv.x, uv.y) >= part.alphaCutoff;
+}
+
+void TriangleMesh::updateHotTriangles()
+{
+    const size_t triangleCount = getTriangleCount();
+    hotTriangles.resize(triangleCount);
+    parallelFor(triangleCount, [&](size_t i) {
+        hotTriangles[i] = TriangleHot::fromVertices(positions[indices[3 * i]], positions[indices[3 * i + 1]], positions[indices[3 * i + 2]]);
+    });
+
+    alphaTested = false;
+    for (const MeshPart& part : parts) {
+        if (part.textureIndex >= 0 && textures && (*textures)[part.textureIndex].hasCutout(part.alphaCutoff)) alphaTested = true;
+    }
+
+    if (triangleTest == TriangleTest::BaldwinWeber) {
+        affineTriangles.resize(triangleCount);
+        parallelFor(triangleCount, [&](size_t i) {
+            affineTriangles[i] = TriangleAffine::fromVertices(positions[indices[3 * i]], positions[indices[3 * i + 1]], positions[indices[3 * i + 2]]);
+        });
+    } else {
+        affineTriangles.clear();
+        affineTriangles.shrink_to_fit();
+    }
+}
+
+void TriangleMesh::setTriangleTest(TriangleTest test)
+{
+    triangleTest = test;
+    updateHotTriangles();
+}
+
+void TriangleMesh::buildTriangleBlocks()
+{
+    blocks4.clear();
+    blocks8.clear();
+    leafBlocks.clear();
+
+    switch (bvhSettings.leafGroupSize) {
+    case 4: packLeaves(blocks4); break;
+    case 8: packLeaves(blocks8); break;
+    default: break;
+    }
+}
+
+template<int N>
+void TriangleMesh::packLeaves(std::vector<TriangleBlock<N>>& blocks)
+{
+    // Every layout keeps the leaves of the binary tree, so its leaves are all there is to pack
+    const std::vector<uint32_t>& primIndices = bvh.getPrimIndices();
+    leafBlocks.assign(primIndices.size(), 0);
+
+    for (const BVHNode& node : bvh.getNodes()) {
+        if (!node.isLeaf()) continue;
+
+        leafBlocks[node.leftFirst] = static_cast<uint32_t>(blocks.size());
+        for (uint32_t first = 0; first < node.primCount; first += N) {
+            TriangleBlock<N>& block = blocks.emplace_back();
+            block.clear();
+            for (uint32_t lane = 0; lane < N && first + lane < node.primCount; lane++) {
+                uint32_t triIdx = primIndices[node.leftFirst + first + lane];
+                block.set(lane, hotTriangles[triIdx], triIdx);
+            }
+        }
+    }
+}
+
+std::vector<AABB> TriangleMesh::computeTriangleBounds() const
+{
+    std::vector<AABB> triangleBounds(getTriangleCount());
+    parallelFor(triangleBounds.size(), [&](size_t i) {
+        triangleBounds[i].grow(positions[indices[3 * i]]);
+        triangleBounds[i].grow(positions[indices[3 * i + 1]]);
+        triangleBounds[i].grow(positions[indices[3 * i + 2]]);
+    });
+    return triangleBounds;
 }
 
-void TriangleMesh::loadTextures(const tinygltf::Model& model) 
+// Bounds of the part of the triangle inside box, found by clipping it against all six box planes
+static AABB clipTriangleBounds(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, const AABB& box)
 {
+    // Every plane adds at most one vertex, so 3 + 6 is enough
+    glm::vec3 polygon[9] = {v0, v1, v2};
+    glm::vec3 clipped[9];
+    int count = 3;
+
+    for (int plane = 0; plane < 6 && count > 0; plane++) {
+        int axis = plane / 2;
+        bool isMax = plane % 2 == 1;
+        float limit = isMax ? box.bmax[axis] : box.bmin[axis];
+        auto inside = [&](const glm::vec3& p) { return isMax ? p[axis] <= limit : p[axis] >= limit; };
+
+        int clippedCount = 0;
+        for (int i = 0; i < count; i++) {
+            const glm::vec3& current = polygon[i];
+            const glm::vec3& next = polygon[(i + 1) % count];
+            if (inside(current)) clipped[clippedCount++] = current;
+            if (inside(current) != inside(next)) {
+                float t = (limit - current[axis]) / (next[axis] - current[axis]);
+                glm::vec3 p = current + t * (next - current);
+                p[axis] = limit;
+                clipped[clippedCount++] = p;
+            }
+        }
+        std::copy(clipped, clipped + clippedCount, polygon);
+        count = clippedCount;
+    }
+
+    AABB bounds;
+    for (int i = 0; i < count; i++) {
+        bounds.grow(polygon[i]);
+    }
+    return bounds;
+}
+
+void TriangleMesh::buildBVH(const BVHBuildSettings& settings)
+{
+    bvhSettings = settings;
+    PrimClipFn clipTriangle = [this](uint32_t triIdx, const AABB& box) {
+        return clipTriangleBounds(positions[indices[3 * triIdx]], positions[indices[3 * triIdx + 1]], positions[indices[3 * triIdx + 2]], box);
+    };
+    bvh.build(computeTriangleBounds(), settings, clipTriangle);
+
+    if (settings.clusterNodes) {
+        // Store the triangles in leaf order too, neighbouring leaves then read neighbouring memory.
+        // Only the indices move, the vertices and with them the parts stay where they are.
+        std::vector<uint32_t> order = bvh.sortPrimitives();
+        std::vector<uint32_t> sorted;
+        sorted.reserve(indices.size());
+        for (uint32_t oldIdx : order) {
+            sorted.insert(sorted.end(), &indices[3 * oldIdx], &indices[3 * oldIdx + 3]);
+        }
+        indices.swap(sorted);
+    }
+    buildWideBVH();
+    updateHotTriangles();
+    buildTriangleBlocks();
+
+    // Reported so time to first pixel can be tracked on big scenes
+    const char* builderName = settings.mode == BVHBuildMode::LBVH ? "LBVH" : settings.mode == BVHBuildMode::SBVH ? "SBVH" : "SAH BVH";
+    std::cout << builderName << " built in " << bvh.getBuildTime() << " ms (" << getTriangleCount() << " triangles, "
+              << bvh.getNodes().size() << " nodes, " << bvh.getPrimIndices().size() << " references, "
+              << (settings.threadCount == 0 ? workerCount() : settings.threadCount) << " threads)" << std::endl;
+}
+
+void TriangleMesh::buildWideBVH()
+{
+    bvh4.clear();
+    bvh8.clear();
+    qbvh2.clear();
+    qbvh4.clear();
+    qbvh8.clear();
+
+    if (bvhSettings.compressed) {
+        switch (bvhSettings.layout) {
+        case BVHLayout::Wide4: qbvh4.build(bvh); break;
+        case BVHLayout::Wide8: qbvh8.build(bvh); break;
+        default: qbvh2.build(bvh); break;
+        }
+    } else if (bvhSettings.layout == BVHLayout::Wide4) {
+        bvh4.build(bvh);
+    } else if (bvhSettings.layout == BVHLayout::Wide8) {
+        bvh8.build(bvh);
+    }
+}
+
+size_t TriangleMesh::getBVHMemory() const
+{
+    return bvh.memoryUsage() + bvh4.memoryUsage() + bvh8.memoryUsage() +
+           qbvh2.memoryUsage() + qbvh4.memoryUsage() + qbvh8.memoryUsage();
+}
+
+size_t TriangleMesh::getTriangleMemory() const
+{
+    return hotTriangles.size() * sizeof(TriangleHot) + affineTriangles.size() * sizeof(TriangleAffine) +
+           blocks4.size() * sizeof(TriangleBlock<4>) + blocks8.size() * sizeof(TriangleBlock<8>) +
+           leafBlocks.size() * sizeof(uint32_t);
+}
+
+size_t TriangleMesh::getTraversedBVHMemory() const
+{
+    size_t bytes = 0;
+    visitBVH([&](const auto& structure) { bytes = structure.memoryUsage(); });
+    return bytes;
+}
+
+void TriangleMesh::refitBVH()
+{
+    // SBVH leaves hold clipped references, growing them by whole triangle bounds would undo every split
+    if (bvhSettings.mode == BVHBuildMode::SBVH) {
+        buildBVH(bvhSettings);
+        return;
+    }
+
+    updateHotTriangles();
+    bvh.refit(computeTriangleBounds(), bvhSettings.threadCount);
+
+    if (bvh.needsRebuild()) {
+        std::cout << "BVH degraded to " << bvh.getDegradation() << "x its built cost, rebuilding" << std::endl;
+        buildBVH(bvhSettings);
+    } else {
+        buildWideBVH(); // Collapsing again is linear and far cheaper than refitting wide nodes in place
+        buildTriangleBlocks();
+    }
+}
+
+template<unsigned Flags>
+bool TriangleMesh::intersect(Ray& ray, HitRecord& hit) const
+{
+    // Decided once per ray, every kernel below is then free of the texture check
+    if constexpr ((Flags & RAY_ALPHA_TEST) == 0) {
+        if (alphaTested) return intersect<Flags | RAY_ALPHA_TEST>(ray, hit);
+    }
+
+    // The blocks only have the closest hit kernel
+    if constexpr ((Flags & (RAY_ANY_HIT | RAY_CULL_BACKFACES | RAY_ALPHA_TEST)) == 0) {
+        switch (bvhSettings.leafGroupSize) {
+        case 4: return intersectBlocks<Flags>(ray, hit, blocks4);
+        case 8: return intersectBlocks<Flags>(ray, hit, blocks8);
+        default: break;
+        }
+    }
+
+    // Traversal only reads the hot triangles, the shared buffers are read by shade for the closest hit
+    bool found = false;
+    visitTriangles([&](const auto& hot) {
+        auto intersectTriangle = [&](uint32_t triIdx) {
+            float t, u, v;
+            if (!hot[triIdx].template intersect<Flags>(ray, ray.tmax, t, u, v)) return false;
+            if constexpr ((Flags & RAY_ALPHA_TEST) != 0) {
+                if (!opaqueAt(triIdx, u, v)) return false;
+            }
+
+            ray.tmax = t;
+            hit.t = t;
+            if constexpr ((Flags & RAY_NO_UVS) == 0) {
+                hit.u = u;
+                hit.v = v;
+            }
+            hit.primId = triIdx;
+            found = true;
+            return true;
+        };
+        visitBVH([&](const auto& structure) { structure.template intersect<Flags>(ray, ray.tmax, intersectTriangle); });
+    });
+    return found;
+}
+
+template<unsigned Flags, int N>
+bool TriangleMesh::intersectBlocks(Ray& ray, HitRecord& hit, const std::vector<TriangleBlock<N>>& blocks) const
+{
+    bool found = false;
+    auto intersectLeaf = [&](uint32_t first, uint32_t count) {
+        const TriangleBlock<N>* block = &blocks[leafBlocks[first]];
+        for (uint32_t i = 0; i < count; i += N, block++) {
+            float t, u, v;
+            int lane = TriangleBlockTest<N>::intersect(*block, ray, ray.tmax, t, u, v);
+            if (lane >= 0) {
+                ray.tmax = t;
+                hit.t = t;
+                if constexpr ((Flags & RAY_NO_UVS) == 0) {
+                    hit.u = u;
+                    hit.v = v;
+                }
+                hit.primId = block->primId[lane];
+                found = true;
+            }
+        }
+    };
+
+    visitBVH([&](const auto& structure) { structure.intersectLeaves(ray, ray.tmax, intersectLeaf); });
+    return found;
+}
+
+template bool TriangleMesh::intersect<RAY_CLOSEST_HIT>(Ray& ray, HitRecord& hit) const;
+template bool TriangleMesh::intersect<RAY_CULL_BACKFACES>(Ray& ray, HitRecord& hit) const;
+template bool TriangleMesh::intersect<RAY_NO_UVS>(Ray& ray, HitRecord& hit) const;
+template bool TriangleMesh::intersect<RAY_ANY_HIT | RAY_NO_UVS>(Ray& ray, HitRecord& hit) const;
+
+HitResult TriangleMesh::shade(const Ray& ray, const HitRecord& hit) const
+{
+    return getTriangle(hit.primId).shade(ray, hit, *textures);
+}
+
+std::optional<HitResult> TriangleMesh::intersect(const Ray& ray) const
+{
+    Ray query = ray;
+    HitRecord hit;
+    if (!intersect(query, hit)) return std::nullopt;
+    return shade(ray, hit);
+}
+
+void TriangleMesh::intersectTile(const Frustum& frustum, const Ray* rays, uint32_t rayCount, HitRecord* hits) const
+{
+    float closestT[MAX_TILE_RAYS];
+    for (uint32_t i = 0; i < rayCount; i++) {
+        closestT[i] = rays[i].tmax;
+    }
+
+    visitTriangles([&](const auto& hot) {
+        bvh.intersectTile(frustum, rays, rayCount, closestT, [&](uint32_t triIdx, uint32_t firstRay, uint32_t endRay) {
+            const auto& triangle = hot[triIdx];
+            for (uint32_t i = firstRay; i < endRay; i++) {
+                float t, u, v;
+                if (!triangle.intersect(rays[i], closestT[i], t, u, v)) continue;
+                if (alphaTested && !opaqueAt(triIdx, u, v)) continue;
+
+                closestT[i] = t;
+                hits[i].t = t;
+                hits[i].u = u;
+                hits[i].v = v;
+                hits[i].primId = triIdx;
+            }
+        });
+    });
+}
+
+template<int N>
+PacketMask TriangleMesh::intersectPacketAlphaTested(RayPacket<N>& packet, PacketMask active, uint32_t triIdx,
+                                                    float* t, float* u, float* v) const
+{
+    PacketMask hit = 0;
+    for (int lane = 0; active != 0; lane++) {
+        if (!(active & (PacketMask(1) << lane))) continue;
+        active &= active - 1;
+
+        float laneT, laneU, laneV;
+        if (!hotTriangles[triIdx].intersect(packet.ray(lane), packet.closestT[lane], laneT, laneU, laneV)) continue;
+        if (!opaqueAt(triIdx, laneU, laneV)) continue;
+
+        packet.closestT[lane] = t[lane] = laneT;
+        u[lane] = laneU;
+        v[lane] = laneV;
+        hit |= PacketMask(1) << lane;
+    }
+    return hit;
+}
+
+template<int N>
+void TriangleMesh::intersectPacket(RayPacket<N>& packet, PacketMask active, HitRecord* hits) const
+{
+    // Records are only filled in at the end, the lanes keep the last (and so closest) hit until then
+    float t[N], u[N], v[N];
+    uint32_t primIds[N];
+    std::fill(primIds, primIds + N, HitRecord::NONE);
+
+    bvh.intersectPacket(packet, active, [&](uint32_t triIdx, PacketMask mask) {
+        PacketMask hit = alphaTested ? intersectPacketAlphaTested(packet, mask, triIdx, t, u, v)
+                                     : intersectPacketTriangle(packet, mask, hotTriangles[triIdx], t, u, v);
+        for (int lane = 0; hit != 0; lane++) {
+            if (!(hit & (PacketMask(1) << lane))) continue;
+            primIds[lane] = triIdx;
+            hit &= hit - 1;
+        }
+    });
+
+    for (int lane = 0; lane < N; lane++) {
+        if (primIds[lane] == HitRecord::NONE) continue;
+        hits[lane].t = t[lane];
+        hits[lane].u = u[lane];
+        hits[lane].v = v[lane];
+        hits[lane].primId = primIds[lane];
+    }
+}
+
+template void TriangleMesh::intersectPacket(RayPacket<16>& packet, PacketMask active, HitRecord* hits) const;
+template void TriangleMesh::intersectPacket(RayPacket<64>& packet, PacketMask active, HitRecord* hits) const;
+
+bool TriangleMesh::occluded(const Ray& ray) const
+{
+    Ray query = ray;
+    HitRecord hit;
+    return intersect<RAY_ANY_HIT | RAY_NO_UVS>(query, hit);
+}
+
+template<int N>
+PacketMask TriangleMesh::occludedPacket(RayPacket<N>& packet, PacketMask active) const
+{
+    float t[N], u[N], v[N];
+    return bvh.occludedPacket(packet, active, [&](uint32_t triIdx, PacketMask mask) {
+        if (alphaTested) return intersectPacketAlphaTested(packet, mask, triIdx, t, u, v);
+        return intersectPacketTriangle(packet, mask, hotTriangles[triIdx], t, u, v);
+    });
+}
+
+template PacketMask TriangleMesh::occludedPacket(RayPacket<16>& packet, PacketMask active) const;
+template PacketMask TriangleMesh::occludedPacket(RayPacket<64>& packet, PacketMask active) const;
+
+std::shared_ptr<std::vector<Texture>> TriangleMesh::loadTextures(const tinygltf::Model& model) 
+{
+    auto modelTextures = std::make_shared<std::vector<Texture>>();
     for (const auto& image : model.images) {
-        textures.emplace_back(image.width, image.height, image.component, image.image);
+        modelTextures->emplace_back(image.width, image.height, image.component, image.image);
     }
+    return modelTextures;
 }
 
-void TriangleMesh::processPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive) 
+// Element i of an accessor, honouring the stride of its buffer view
+template<typename T>
+static const T& accessorElement(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t i)
 {
-    const auto& indicesAccessor = model.accessors[primitive.indices];
-    const auto& indicesView = model.bufferViews[indicesAccessor.bufferView];
-    const auto& indicesBuffer = model.buffers[indicesView.buffer];
+    const auto& view = model.bufferViews[accessor.bufferView];
+    const auto& buffer = model.buffers[view.buffer];
+    return *reinterpret_cast<const T*>(buffer.data.data() + view.byteOffset + accessor.byteOffset + i * accessor.ByteStride(view));
+}
 
+void TriangleMesh::processPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive) 
+{
+    // The primitive's vertices are appended as they are, its indices are offset to point at them
+    const uint32_t firstVertex = static_cast<uint32_t>(positions.size());
     const auto& positionAccessor = model.accessors.at(primitive.attributes.at("POSITION"));
-    const auto& positionView = model.bufferViews[positionAccessor.bufferView];
-    const auto& positionBuffer = model.buffers[positionView.buffer];
+    const size_t vertexCount = positionAccessor.count;
 
     bool hasNormals = primitive.attributes.count("NORMAL") > 0;
     const tinygltf::Accessor* normalAccessor = nullptr; 
-    const tinygltf::BufferView* normalView = nullptr;
-    const tinygltf::Buffer* normalBuffer = nullptr;
-
     if (hasNormals) {
         normalAccessor = &model.accessors.at(primitive.attributes.at("NORMAL"));
-        normalView = &model.bufferViews[normalAccessor->bufferView];
-        normalBuffer = &model.buffers[normalView->buffer];
 
         // Check if the buffer has data
-        if (normalAccessor->count == 0 || normalBuffer->data.empty()) {
+        const auto& normalView = model.bufferViews[normalAccessor->bufferView];
+        if (normalAccessor->count < vertexCount || model.buffers[normalView.buffer].data.empty()) {
             hasNormals = false; // If empty, fall back to computing normals
         }
     }
-    const auto& texCoordAcessor = model.accessors.at(primitive.attributes.at("TEXCOORD_0"));
-    const auto& texCoordView = model.bufferViews[texCoordAcessor.bufferView];
-    const auto& texCoordBuffer = model.buffers[texCoordView.buffer];
+    const auto& texCoordAccessor = model.accessors.at(primitive.attributes.at("TEXCOORD_0"));
 
     int textureIndex = -1;
+    float alphaCutoff = 0.0f;
     if (primitive.material >= 0) {
         const auto& material = model.materials[primitive.material];
         if (material.pbrMetallicRoughness.baseColorTexture.index >= 0) {
             textureIndex = material.pbrMetallicRoughness.baseColorTexture.index;
         }
+        // Only masked materials have holes, OPAQUE ignores alpha and BLEND is traced as opaque
+        if (material.alphaMode == "MASK") {
+            alphaCutoff = static_cast<float>(material.alphaCutoff);
+        }
     }
+    parts.push_back({firstVertex, textureIndex, alphaCutoff, !hasNormals});
 
-    const uint16_t* indexData = reinterpret_cast<const uint16_t*>(
-        indicesBuffer.data.data() + indicesView.byteOffset + indicesAccessor.byteOffset);
-    const float* positionData = reinterpret_cast<const float*>(
-        positionBuffer.data.data() + positionView.byteOffset + positionAccessor.byteOffset);
-
-    for (size_t i = 0; i < indicesAccessor.count; i += 3) {
-
-        glm::vec3 v0 = glm::vec3(positionData[3 * indexData[i]], positionData[3 * indexData[i] + 1], positionData[3 * indexData[i] + 2]);
-        glm::vec3 v1 = glm::vec3(positionData[3 * indexData[i + 1]], positionData[3 * indexData[i + 1] + 1], positionData[3 * indexData[i + 1] + 2]);
-        glm::vec3 v2 = glm::vec3(positionData[3 * indexData[i + 2]], positionData[3 * indexData[i + 2] + 1], positionData[3 * indexData[i + 2] + 2]);
+    positions.reserve(firstVertex + vertexCount);
+    normals.reserve(firstVertex + vertexCount);
+    uvs.reserve(firstVertex + vertexCount);
+    for (size_t i = 0; i < vertexCount; i++) {
+        positions.push_back(accessorElement<glm::vec3>(model, positionAccessor, i));
+        normals.push_back(hasNormals ? accessorElement<glm::vec3>(model, *normalAccessor, i) : glm::vec3(0.0f));
+        uvs.push_back(accessorElement<glm::vec2>(model, texCoordAccessor, i));
+    }
 
-        glm::vec3 normal;
-        if (hasNormals) {
-            const float* normalData = reinterpret_cast<const float*>(
-                normalBuffer->data.data() + normalView->byteOffset + normalAccessor->byteOffset);
-                normal = glm::vec3(normalData[3 * indexData[i]], normalData[3 * indexData[i] + 1], normalData[3 * indexData[i] + 2]);
-        } else {
-            normal = computeNormal(v0, v1, v2);
+    // glTF allows 8, 16 and 32 bit indices, or none for a plain list of vertices
+    if (primitive.indices < 0) {
+        for (size_t i = 0; i < vertexCount - vertexCount % 3; i++) {
+            indices.push_back(firstVertex + static_cast<uint32_t>(i));
         }
+        return;
+    }
 
-        const float* texCoordData = reinterpret_cast<const float*>(
-            texCoordBuffer.data.data() + texCoordView.byteOffset + texCoordAcessor.byteOffset);
-
-        glm::vec2 uv0 = glm::vec2(texCoordData[2 * indexData[i]], texCoordData[2 * indexData[i] + 1]);
-        glm::vec2 uv1 = glm::vec2(texCoordData[2 * indexData[i + 1]], texCoordData[2 * indexData[i + 1] + 1]);
-        glm::vec2 uv2 = glm::vec2(texCoordData[2 * indexData[i + 2]], texCoordData[2 * indexData[i + 2] + 1]);
-
-        triangles.push_back({v0, v1, v2, normal, uv0, uv1, uv2, textureIndex});
+    const auto& indicesAccessor = model.accessors[primitive.indices];
+    const size_t indexCount = indicesAccessor.count - indicesAccessor.count % 3;
+    indices.reserve(indices.size() + indexCount);
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t index;
+        switch (indicesAccessor.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: index = accessorElement<uint8_t>(model, indicesAccessor, i); break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: index = accessorElement<uint16_t>(model, indicesAccessor, i); break;
+        default: index = accessorElement<uint32_t>(model, indicesAccessor, i); break;
+        }
+        indices.push_back(firstVertex + index);
     }
 }
 